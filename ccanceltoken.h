@@ -0,0 +1,50 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CCANCELTOKEN_H
+#define CCANCELTOKEN_H
+
+#include <QAtomicInt>
+
+//! cooperative cancellation flag, shared between gui and worker threads
+/*!
+ * Workers check the token at stage boundaries (after decoding, after
+ * painting) and while encoding, so a cancel takes effect within a fraction
+ * of a frame instead of after it.
+ */
+class CCancelToken
+{
+public:
+  CCancelToken() : m_cancelled( 0 ) {}
+
+  //! request cancellation
+  void cancel() { m_cancelled.fetchAndStoreOrdered( 1 ); }
+  //! arm the token for the next run
+  void reset() { m_cancelled.fetchAndStoreOrdered( 0 ); }
+  //! whether cancellation has been requested
+  bool isCancelled() const { return m_cancelled != 0; }
+
+private:
+  QAtomicInt m_cancelled;
+};
+
+#endif // CCANCELTOKEN_H
@@ -0,0 +1,529 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QPainter>
+#include <QFontMetrics>
+#include <QFontMetricsF>
+#include <QCryptographicHash>
+#include <QDesktopServices>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QWeakPointer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include <QGraphicsSimpleTextItem>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cglyphcache.h"
+#include "ctimecoderenderer.h"
+#include "cpixelkernels.h"
+
+// bump whenever rasterization or the file layout changes
+#define GLYPH_CACHE_VERSION 3
+// identifies cache files
+#define GLYPH_CACHE_MAGIC   0x74636763
+// every character a timecode can contain
+#define GLYPH_CHARS         "0123456789:."
+// per channel difference to drawText() still considered exact
+#define GLYPH_TOLERANCE     2
+// caches kept in memory, the least recently used one goes first
+#define GLYPH_CACHE_MEMORY  16
+// cache files kept on disk, the oldest ones go first
+#define GLYPH_CACHE_FILES   64
+
+//! a cache in memory with the time it has been asked for last
+struct CGlyphCacheEntry
+{
+  QSharedPointer<const CGlyphCache> cache;
+  quint64 lastUse;
+};
+
+// caches already loaded by this process, keyed like the files
+static QMutex s_mutex;
+static QHash<QByteArray, CGlyphCacheEntry> s_caches;
+// every cache still alive, including evicted ones a job holds on to for its run
+static QHash<QByteArray, QWeakPointer<const CGlyphCache> > s_alive;
+// counts calls of get(), orders the entries by use
+static quint64 s_useCount = 0;
+// replaces the cache directory if not null, see setCacheDir()
+static QString s_cacheDir;
+
+// add a cache to the memory cache, evicting the least recently used one (s_mutex must be held)
+static void insertEntry( const QByteArray &hash, const CGlyphCacheEntry &entry )
+{
+  // callers still holding an evicted cache keep it alive until they are done
+  if( s_caches.size() >= GLYPH_CACHE_MEMORY )
+  {
+    QHash<QByteArray, CGlyphCacheEntry>::iterator oldest = s_caches.begin();
+    QHash<QByteArray, CGlyphCacheEntry>::iterator it;
+    for( it = s_caches.begin(); it != s_caches.end(); ++it )
+    {
+      if( it->lastUse < oldest->lastUse )
+        oldest = it;
+    }
+    s_caches.erase( oldest );
+
+    // forget caches nobody holds any more
+    QHash<QByteArray, QWeakPointer<const CGlyphCache> >::iterator alive = s_alive.begin();
+    while( alive != s_alive.end() )
+    {
+      if( alive->isNull() )
+        alive = s_alive.erase( alive );
+      else
+        ++alive;
+    }
+  }
+
+  s_caches.insert( hash, entry );
+}
+
+// a directory below the temporary directory only the current user can access
+static QString privateTempDir()
+{
+#ifdef Q_OS_UNIX
+  QString dir = QDir::tempPath() + "/timecode4-" + QString::number( getuid() );
+  QByteArray path = QFile::encodeName( dir );
+
+  // someone else may have created it first, so it is only used if it is ours and closed to others
+  ::mkdir( path.constData(), 0700 );
+  struct stat st;
+  if( ::lstat( path.constData(), &st ) != 0 || !S_ISDIR( st.st_mode )
+      || st.st_uid != getuid() || (st.st_mode & 077) != 0 )
+    return QString();
+  return dir;
+#else
+  // the temporary directory is per user already
+  return QDir::tempPath() + "/timecode4-" + QString::fromLocal8Bit( qgetenv( "USERNAME" ) );
+#endif
+}
+
+// blend src placed at pos into overlay, which covers rect of the frame
+static void blendClipped( QImage &overlay, const QRect &rect, const QImage &src, const QPoint &pos )
+{
+  QRect target = QRect( pos, src.size() ).intersected( rect );
+  if( target.isEmpty() )
+    return;
+
+  for( int y = target.top(); y <= target.bottom(); y++ )
+  {
+    unsigned int *dst = reinterpret_cast<unsigned int*>( overlay.scanLine( y - rect.top() ) ) + target.left() - rect.left();
+    const unsigned int *line = reinterpret_cast<const unsigned int*>( src.scanLine( y - pos.y() ) ) + target.left() - pos.x();
+    CPixelKernels::blendPremultiplied( dst, line, target.width() );
+  }
+}
+
+// premultiplied pixels are stored raw, png would round them through straight alpha
+static void writeImage( QDataStream &stream, const QImage &image )
+{
+  stream << qint32( image.width() ) << qint32( image.height() );
+  for( int y = 0; y < image.height(); y++ )
+    stream.writeRawData( reinterpret_cast<const char*>( image.scanLine( y ) ), image.width() * 4 );
+}
+
+// counterpart of writeImage()
+static QImage readImage( QDataStream &stream )
+{
+  qint32 width, height;
+  stream >> width >> height;
+  if( stream.status() != QDataStream::Ok || width < 0 || height < 0 || width > 16384 || height > 16384 )
+    return QImage();
+
+  QImage image( width, height, QImage::Format_ARGB32_Premultiplied );
+  for( int y = 0; y < height; y++ )
+    if( stream.readRawData( reinterpret_cast<char*>( image.scanLine( y ) ), width * 4 ) != width * 4 )
+      return QImage();
+  return image;
+}
+
+QSharedPointer<const CGlyphCache> CGlyphCache::get( const CTimecodeSettings &settings )
+{
+  QByteArray hash = key( settings );
+
+  {
+    QMutexLocker locker( &s_mutex );
+
+    QHash<QByteArray, CGlyphCacheEntry>::iterator it = s_caches.find( hash );
+    if( it != s_caches.end() )
+    {
+      it->lastUse = ++s_useCount;
+      return it->cache;
+    }
+
+    // evicted, but still held by a job: back into the memory cache
+    QSharedPointer<const CGlyphCache> alive = s_alive.value( hash ).toStrongRef();
+    if( !alive.isNull() )
+    {
+      CGlyphCacheEntry entry;
+      entry.cache   = alive;
+      entry.lastUse = ++s_useCount;
+      insertEntry( hash, entry );
+      return alive;
+    }
+  }
+
+  // not in memory, try the disk before touching the font; without the lock,
+  // so a miss does not stall the threads stamping with other caches
+  QString dir = cacheDir();
+  QString path = dir.isEmpty() ? QString() : dir + "/" + hash.toHex() + ".glyphs";
+  CGlyphCache *cache = new CGlyphCache;
+  if( path.isEmpty() || !cache->load( path ) )
+  {
+    cache->rasterize( settings );
+    if( !path.isEmpty() && cache->save( path ) )
+      prune( dir );
+  }
+
+  QMutexLocker locker( &s_mutex );
+
+  // another thread may have been faster, everybody uses the same cache
+  QHash<QByteArray, CGlyphCacheEntry>::iterator it = s_caches.find( hash );
+  if( it != s_caches.end() )
+  {
+    delete cache;
+    it->lastUse = ++s_useCount;
+    return it->cache;
+  }
+
+  CGlyphCacheEntry entry;
+  entry.cache   = QSharedPointer<const CGlyphCache>( cache );
+  entry.lastUse = ++s_useCount;
+  insertEntry( hash, entry );
+  s_alive.insert( hash, entry.cache.toWeakRef() );
+  return entry.cache;
+}
+
+QString CGlyphCache::cacheDir()
+{
+  {
+    QMutexLocker locker( &s_mutex );
+    if( !s_cacheDir.isNull() )
+      return s_cacheDir;
+  }
+
+  QString dir = QDesktopServices::storageLocation( QDesktopServices::CacheLocation );
+  // headless nodes may not have a cache location
+  if( dir.isEmpty() )
+    dir = privateTempDir();
+  if( dir.isEmpty() )
+    return QString();
+  return dir + "/glyphs";
+}
+
+void CGlyphCache::setCacheDir( const QString &dir )
+{
+  QMutexLocker locker( &s_mutex );
+  s_cacheDir = dir;
+}
+
+QSize CGlyphCache::badgeSize() const
+{
+  return m_badgeSize;
+}
+
+QRect CGlyphCache::extent( const QPoint &pos, const QString &text ) const
+{
+  QRect rect( pos, m_badge.size() );
+  QPoint origin = pos + m_textOrigin;
+
+  qreal pen = 0;
+  for( int i = 0; i < text.size(); i++ )
+  {
+    QMap<ushort, Glyph>::const_iterator it = m_glyphs.constFind( text.at( i ).unicode() );
+    if( it == m_glyphs.constEnd() )
+      continue;
+
+    QPoint topLeft = origin + QPoint( qRound( pen ), 0 ) + it->offset;
+    rect = rect.united( QRect( topLeft, it->image.size() ) );
+    if( i + 1 < text.size() )
+      pen += advance( text.at( i ).unicode(), text.at( i + 1 ).unicode() );
+  }
+
+  // some room for antialiasing, drawText() may place glyphs a bit differently if inexact
+  int slack = m_exact ? 2 : 2 + m_badge.height()/2;
+  return rect.adjusted( -slack, -2, slack, 2 );
+}
+
+void CGlyphCache::compose( QImage &overlay, const QRect &rect, const QPoint &pos, const QString &text ) const
+{
+  blendClipped( overlay, rect, m_badge, pos );
+
+  if( m_exact )
+    composeText( overlay, rect, pos + m_textOrigin, text );
+}
+
+bool CGlyphCache::exact() const
+{
+  return m_exact;
+}
+
+void CGlyphCache::composeText( QImage &overlay, const QRect &rect, const QPoint &origin, const QString &text ) const
+{
+  qreal pen = 0;
+  for( int i = 0; i < text.size(); i++ )
+  {
+    QMap<ushort, Glyph>::const_iterator it = m_glyphs.constFind( text.at( i ).unicode() );
+    if( it == m_glyphs.constEnd() )
+      continue;
+
+    blendClipped( overlay, rect, it->image, origin + QPoint( qRound( pen ), 0 ) + it->offset );
+    if( i + 1 < text.size() )
+      pen += advance( text.at( i ).unicode(), text.at( i + 1 ).unicode() );
+  }
+}
+
+qreal CGlyphCache::advance( ushort a, ushort b ) const
+{
+  qreal width = m_glyphs.value( a ).advance;
+  return width + m_kerning.value( (quint32( a ) << 16) | b, 0 );
+}
+
+QByteArray CGlyphCache::key( const CTimecodeSettings &settings )
+{
+  QByteArray data;
+  QDataStream stream( &data, QIODevice::WriteOnly );
+
+  // everything that changes the look of badge or glyphs, but not the position; the
+  // badge size follows from the font, the text font carries the resolution
+  stream << qint32( GLYPH_CACHE_VERSION ) << settings.textFont().toString()
+         << settings.font.toString()
+         << settings.textColor.rgba() << settings.frameColor.rgba() << qint32( RECTALPHA );
+
+  return QCryptographicHash::hash( data, QCryptographicHash::Md5 );
+}
+
+void CGlyphCache::rasterize( const CTimecodeSettings &settings )
+{
+  // point sizes are already turned into pixels, no resolution involved
+  QFont font = settings.textFont();
+
+  // a tiny image to measure on, usable outside the gui thread
+  QImage probe( 1, 1, QImage::Format_ARGB32_Premultiplied );
+
+  // measure the same sample text the preview shows
+  QGraphicsSimpleTextItem sample( "03:22:43.04" );
+  sample.setFont( font );
+  unsigned int fontSize = (settings.font.pixelSize() == -1 ? settings.font.pointSize() : settings.font.pixelSize());
+  m_badgeSize = QSize( sample.boundingRect().width() + fontSize/2, sample.boundingRect().height() );
+
+  // same offsets CTimecodeRenderer uses for the text, relative to the badge
+  CTimecodeSettings badge = settings;
+  badge.posX        = 0;
+  badge.posY        = 0;
+  badge.badgeWidth  = m_badgeSize.width();
+  badge.badgeHeight = m_badgeSize.height();
+  m_textOrigin = CTimecodeRenderer::textOrigin( badge );
+
+  // rounded rectangle at the origin
+  m_badge = QImage( m_badgeSize.width() + 2, m_badgeSize.height() + 2, QImage::Format_ARGB32_Premultiplied );
+  m_badge.fill( 0 );
+  {
+    QPainter painter( &m_badge );
+    CTimecodeRenderer::drawBadge( painter, badge );
+  }
+
+  QFontMetrics metrics( font, &probe );
+  QFontMetricsF metricsF( font, &probe );
+  const QString chars = GLYPH_CHARS;
+
+  m_glyphs.clear();
+  for( int i = 0; i < chars.size(); i++ )
+  {
+    QChar c = chars.at( i );
+    // some room for antialiasing
+    QRect bounds = metrics.boundingRect( c ).adjusted( -1, -1, 1, 1 );
+
+    Glyph glyph;
+    glyph.offset  = bounds.topLeft();
+    glyph.advance = metricsF.width( c );
+    glyph.image   = QImage( bounds.size(), QImage::Format_ARGB32_Premultiplied );
+    glyph.image.fill( 0 );
+
+    QPainter painter( &glyph.image );
+    painter.setFont( font );
+    painter.setPen( settings.textColor );
+    painter.drawText( -bounds.left(), -bounds.top(), QString( c ) );
+    painter.end();
+
+    m_glyphs.insert( c.unicode(), glyph );
+  }
+
+  // kerning is what a pair is wider or narrower than its two advances
+  m_kerning.clear();
+  for( int i = 0; i < chars.size(); i++ )
+  {
+    for( int j = 0; j < chars.size(); j++ )
+    {
+      QString pair = QString( chars.at( i ) ) + chars.at( j );
+      qreal kerning = metricsF.width( pair ) - metricsF.width( chars.at( i ) ) - metricsF.width( chars.at( j ) );
+      if( !qFuzzyCompare( 1.0 + kerning, 1.0 ) )
+        m_kerning.insert( (quint32( chars.at( i ).unicode() ) << 16) | chars.at( j ).unicode(), kerning );
+    }
+  }
+
+  m_exact = verify( settings );
+}
+
+bool CGlyphCache::verify( const CTimecodeSettings &settings ) const
+{
+  QFont font = settings.textFont();
+  const QString chars = GLYPH_CHARS;
+
+  for( int i = 0; i < chars.size(); i++ )
+  {
+    // "a0a1a2...", all lines together contain every pair of characters
+    QString line;
+    for( int j = 0; j < chars.size(); j++ )
+      line += QString( chars.at( i ) ) + chars.at( j );
+
+    QRect rect = extent( QPoint( 0, 0 ), line ).adjusted( -8, -8, 8, 8 );
+
+    QImage expected( rect.size(), QImage::Format_ARGB32_Premultiplied );
+    expected.fill( 0 );
+    {
+      QPainter painter( &expected );
+      painter.translate( -rect.topLeft() );
+      painter.setFont( font );
+      painter.setPen( settings.textColor );
+      painter.drawText( m_textOrigin, line );
+    }
+
+    QImage composed( rect.size(), QImage::Format_ARGB32_Premultiplied );
+    composed.fill( 0 );
+    composeText( composed, rect, m_textOrigin, line );
+
+    for( int y = 0; y < rect.height(); y++ )
+    {
+      const QRgb *a = reinterpret_cast<const QRgb*>( expected.scanLine( y ) );
+      const QRgb *b = reinterpret_cast<const QRgb*>( composed.scanLine( y ) );
+      for( int x = 0; x < rect.width(); x++ )
+      {
+        // overlapping antialiased edges may round differently
+        if( qAbs( qRed( a[x] ) - qRed( b[x] ) ) > GLYPH_TOLERANCE || qAbs( qGreen( a[x] ) - qGreen( b[x] ) ) > GLYPH_TOLERANCE
+            || qAbs( qBlue( a[x] ) - qBlue( b[x] ) ) > GLYPH_TOLERANCE || qAbs( qAlpha( a[x] ) - qAlpha( b[x] ) ) > GLYPH_TOLERANCE )
+          return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool CGlyphCache::load( const QString &path )
+{
+  QFile file( path );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  QDataStream stream( &file );
+  quint32 magic;
+  qint32 version;
+  stream >> magic >> version;
+  if( magic != GLYPH_CACHE_MAGIC || version != GLYPH_CACHE_VERSION )
+    return false;
+
+  QSize badgeSize;
+  stream >> badgeSize;
+  QImage badge = readImage( stream );
+  QPoint origin;
+  qint32 count;
+  stream >> origin >> count;
+
+  QMap<ushort, Glyph> glyphs;
+  for( int i = 0; i < count && stream.status() == QDataStream::Ok; i++ )
+  {
+    quint16 c;
+    Glyph glyph;
+    stream >> c;
+    glyph.image = readImage( stream );
+    stream >> glyph.offset >> glyph.advance;
+    glyphs.insert( c, glyph );
+  }
+
+  QMap<quint32, qreal> kerning;
+  bool exact;
+  stream >> kerning >> exact;
+
+  // a damaged file is simply rasterized again
+  if( stream.status() != QDataStream::Ok || badge.isNull() )
+    return false;
+
+  m_badgeSize  = badgeSize;
+  m_badge      = badge;
+  m_textOrigin = origin;
+  m_glyphs     = glyphs;
+  m_kerning    = kerning;
+  m_exact      = exact;
+  return true;
+}
+
+void CGlyphCache::prune( const QString &dir )
+{
+  // newest first, partial files of other processes are left alone
+  QFileInfoList files = QDir( dir ).entryInfoList( QStringList( "*.glyphs" ), QDir::Files, QDir::Time );
+  for( int i = GLYPH_CACHE_FILES; i < files.size(); i++ )
+    QFile::remove( files[i].absoluteFilePath() );
+}
+
+bool CGlyphCache::save( const QString &path ) const
+{
+  if( !QDir().mkpath( QFileInfo( path ).absolutePath() ) )
+    return false;
+
+  // several processes may write the same cache, each uses its own partial file
+  QString partial = path + "." + QString::number( QCoreApplication::applicationPid() );
+  QFile file( partial );
+  if( !file.open( QIODevice::WriteOnly ) )
+    return false;
+
+  QDataStream stream( &file );
+  stream << quint32( GLYPH_CACHE_MAGIC ) << qint32( GLYPH_CACHE_VERSION ) << m_badgeSize;
+  writeImage( stream, m_badge );
+  stream << m_textOrigin << qint32( m_glyphs.size() );
+
+  QMap<ushort, Glyph>::const_iterator it;
+  for( it = m_glyphs.constBegin(); it != m_glyphs.constEnd(); ++it )
+  {
+    stream << quint16( it.key() );
+    writeImage( stream, it->image );
+    stream << it->offset << it->advance;
+  }
+
+  stream << m_kerning << m_exact;
+
+  file.close();
+  if( stream.status() != QDataStream::Ok || file.error() != QFile::NoError )
+  {
+    QFile::remove( partial );
+    return false;
+  }
+
+  return CTimecodeRenderer::commitFile( partial, path );
+}
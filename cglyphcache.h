@@ -0,0 +1,123 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CGLYPHCACHE_H
+#define CGLYPHCACHE_H
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+#include <QSharedPointer>
+
+#include "ctimecodesettings.h"
+
+//! pre-rasterized rounded rectangle and timecode glyphs
+/*!
+ * The badge and every character a timecode can contain are painted once
+ * per font, size, resolution and colors and kept on disk across sessions,
+ * together with the badge size measured on the font. Stamping a frame then
+ * only blends these images; a cache hit, also the one of
+ * CTimecodeSettings::updateBadgeSize(), neither loads nor shapes the font.
+ * The position of the badge is not part of the key, moving it does not
+ * invalidate the cache.
+ *
+ * Glyphs are placed on the same pen positions drawText() uses (advances
+ * plus kerning). When the cache is built, every pair of characters is
+ * composed and compared against drawText(); if the font engine places
+ * them differently the cache is marked inexact and only the badge is
+ * taken from it.
+ *
+ * Only the most recently used caches stay in memory (plus those a job holds
+ * on to for its run) and only the newest cache files stay on disk, older
+ * ones are rebuilt when needed again.
+ */
+class CGlyphCache
+{
+public:
+  //! shared cache for settings (thread safe)
+  static QSharedPointer<const CGlyphCache> get( const CTimecodeSettings &settings );
+  //! directory holding the cache files, empty if there is no safe place for them
+  static QString cacheDir();
+  //! keep the cache files in dir instead (checks, tests), a null string restores the default
+  static void setCacheDir( const QString &dir );
+
+  //! size of the rounded rectangle, measured on the font
+  QSize badgeSize() const;
+  //! area covered by badge and text when the badge is placed at pos
+  QRect extent( const QPoint &pos, const QString &text ) const;
+  //! blend badge and text (if exact) placed at pos into overlay, which covers rect of the frame
+  void compose( QImage &overlay, const QRect &rect, const QPoint &pos, const QString &text ) const;
+  //! whether composed text matches drawText() on this system
+  bool exact() const;
+
+private:
+  //! one pre-rasterized character
+  struct Glyph
+  {
+    Glyph() : advance( 0 ) {}
+
+    //! premultiplied glyph image
+    QImage image;
+    //! top left of image relative to the pen position on the baseline
+    QPoint offset;
+    //! distance to the next pen position
+    qreal advance;
+  };
+
+  CGlyphCache() : m_exact( false ) {}
+
+  //! cache key for settings
+  static QByteArray key( const CTimecodeSettings &settings );
+  //! measure the badge, paint it and the glyphs
+  void rasterize( const CTimecodeSettings &settings );
+  //! compare composed glyphs against drawText() for every pair of characters
+  bool verify( const CTimecodeSettings &settings ) const;
+  //! blend the glyphs of text with the pen starting at origin
+  void composeText( QImage &overlay, const QRect &rect, const QPoint &origin, const QString &text ) const;
+  //! pen advance from character a to b, including kerning
+  qreal advance( ushort a, ushort b ) const;
+  //! read a cache file
+  bool load( const QString &path );
+  //! write a cache file
+  bool save( const QString &path ) const;
+  //! remove the oldest cache files beyond the limit
+  static void prune( const QString &dir );
+
+  //! size of the rounded rectangle
+  QSize m_badgeSize;
+  //! the rounded rectangle, top left is the badge position
+  QImage m_badge;
+  //! pen position of the text relative to the badge position
+  QPoint m_textOrigin;
+  //! all characters used by timecodes
+  QMap<ushort, Glyph> m_glyphs;
+  //! kerning of character pairs (first << 16 | second), zero entries left out
+  QMap<quint32, qreal> m_kerning;
+  //! composed text matches drawText()
+  bool m_exact;
+};
+
+#endif // CGLYPHCACHE_H
@@ -0,0 +1,317 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QDataStream>
+#include <QtEndian>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#include "cjobcache.h"
+
+#define CACHE_MAGIC   0x74633463
+#define CACHE_VERSION 2
+// files are hashed in blocks of this size if they can not be mapped
+#define HASH_BLOCK    (1 << 20)
+
+//! xxHash64 (seed 0), several GB/s where MD5 manages a few hundred MB/s
+/*!
+ * Only needs to tell changed inputs apart, not to resist attacks. Data may
+ * be added in pieces of any size, the result is the same as for one piece.
+ */
+class CContentHash
+{
+public:
+  CContentHash() : m_total( 0 ), m_buffered( 0 )
+  {
+    m_v[0] = PRIME1 + PRIME2;
+    m_v[1] = PRIME2;
+    m_v[2] = 0;
+    m_v[3] = 0 - PRIME1;
+  }
+
+  void addData( const uchar *data, qint64 len )
+  {
+    m_total += len;
+
+    // complete a stripe left over from the last call
+    if( m_buffered > 0 )
+    {
+      int fill = int( qMin( qint64( 32 - m_buffered ), len ) );
+      memcpy( m_buffer + m_buffered, data, fill );
+      m_buffered += fill;
+      data += fill;
+      len  -= fill;
+      if( m_buffered < 32 )
+        return;
+      stripe( m_buffer );
+      m_buffered = 0;
+    }
+
+    for( ; len >= 32; data += 32, len -= 32 )
+      stripe( data );
+
+    memcpy( m_buffer, data, len );
+    m_buffered = int( len );
+  }
+
+  QByteArray result() const
+  {
+    quint64 h;
+    if( m_total >= 32 )
+    {
+      h = rotl( m_v[0], 1 ) + rotl( m_v[1], 7 ) + rotl( m_v[2], 12 ) + rotl( m_v[3], 18 );
+      for( int i = 0; i < 4; i++ )
+        h = (h ^ round( 0, m_v[i] )) * PRIME1 + PRIME4;
+    }
+    else
+      h = PRIME5;
+    h += quint64( m_total );
+
+    // the tail of up to 31 bytes
+    const uchar *p = m_buffer, *end = m_buffer + m_buffered;
+    for( ; p + 8 <= end; p += 8 )
+      h = rotl( h ^ round( 0, qFromLittleEndian<quint64>( p ) ), 27 ) * PRIME1 + PRIME4;
+    if( p + 4 <= end )
+    {
+      h = rotl( h ^ (quint64( qFromLittleEndian<quint32>( p ) ) * PRIME1), 23 ) * PRIME2 + PRIME3;
+      p += 4;
+    }
+    for( ; p < end; p++ )
+      h = rotl( h ^ (*p * PRIME5), 11 ) * PRIME1;
+
+    // avalanche
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+
+    uchar bytes[8];
+    qToBigEndian( h, bytes );
+    return QByteArray( reinterpret_cast<const char*>( bytes ), 8 );
+  }
+
+private:
+  static const quint64 PRIME1 = Q_UINT64_C( 11400714785074694791 );
+  static const quint64 PRIME2 = Q_UINT64_C( 14029467366897019727 );
+  static const quint64 PRIME3 = Q_UINT64_C( 1609587929392839161 );
+  static const quint64 PRIME4 = Q_UINT64_C( 9650029242287828579 );
+  static const quint64 PRIME5 = Q_UINT64_C( 2870177450012600261 );
+
+  static quint64 rotl( quint64 x, int r ) { return (x << r) | (x >> (64 - r)); }
+  static quint64 round( quint64 acc, quint64 input ) { return rotl( acc + input * PRIME2, 31 ) * PRIME1; }
+
+  //! consume 32 bytes, one lane of 8 bytes per accumulator
+  void stripe( const uchar *p )
+  {
+    for( int i = 0; i < 4; i++ )
+      m_v[i] = round( m_v[i], qFromLittleEndian<quint64>( p + 8 * i ) );
+  }
+
+  quint64 m_v[4];
+  qint64 m_total;
+  uchar m_buffer[32];
+  int m_buffered;
+};
+
+CJobCache::CJobCache( const QString &outputDir, const QByteArray &settingsKey )
+  : m_path( QDir( outputDir ).absoluteFilePath( fileName() ) ),
+  m_settingsKey( settingsKey ), m_dirty( false )
+{
+  load();
+}
+
+CJobCache::~CJobCache()
+{
+  save();
+}
+
+const char *CJobCache::fileName()
+{
+  return ".timecode4.cache";
+}
+
+bool CJobCache::isUpToDate( const QFileInfo &input, unsigned int seqNo, const QString &output )
+{
+  QHash<QString, Entry>::iterator entry = m_entries.find( QFileInfo( output ).fileName() );
+  if( entry == m_entries.end() )
+    return false;
+
+  // settings or position in the sequence changed
+  if( entry->frameKey != frameKey( seqNo ) )
+    return false;
+
+  // output vanished or has been touched by someone else
+  QFileInfo outInfo( output );
+  if( !outInfo.exists() || outInfo.size() != entry->outputSize
+      || modificationTime( outInfo ) != entry->outputTime )
+    return false;
+
+  // cheap check first: same size and time stamp means same content
+  if( input.size() == entry->inputSize && modificationTime( input ) == entry->inputTime )
+    return true;
+
+  // input has been touched, compare contents
+  if( input.size() != entry->inputSize || hashFile( input.absoluteFilePath() ) != entry->contentHash )
+    return false;
+
+  // same content, just remember the new time stamp
+  entry->inputTime = modificationTime( input );
+  m_dirty = true;
+  return true;
+}
+
+void CJobCache::update( const QFileInfo &input, unsigned int seqNo, const QString &output )
+{
+  QFileInfo outInfo( output );
+  if( !outInfo.exists() )
+    return;
+
+  Entry entry;
+  entry.inputSize   = input.size();
+  entry.inputTime   = modificationTime( input );
+  entry.contentHash = hashFile( input.absoluteFilePath() );
+  entry.frameKey    = frameKey( seqNo );
+  entry.outputSize  = outInfo.size();
+  entry.outputTime  = modificationTime( outInfo );
+
+  m_entries.insert( outInfo.fileName(), entry );
+  m_dirty = true;
+}
+
+bool CJobCache::save()
+{
+  if( !m_dirty )
+    return true;
+
+  // write to a temporary file first, so a crash never leaves a broken cache
+  QFile file( m_path + ".tmp" );
+  if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    return false;
+
+  QDataStream stream( &file );
+  stream << (quint32)CACHE_MAGIC << (quint32)CACHE_VERSION << (quint32)m_entries.size();
+
+  QHash<QString, Entry>::const_iterator it = m_entries.constBegin();
+  for( ; it != m_entries.constEnd(); ++it )
+  {
+    stream << it.key() << it->inputSize << it->inputTime << it->contentHash
+           << it->frameKey << it->outputSize << it->outputTime;
+  }
+  file.close();
+
+  if( stream.status() != QDataStream::Ok )
+  {
+    file.remove();
+    return false;
+  }
+
+  QFile::remove( m_path );
+  if( !file.rename( m_path ) )
+    return false;
+
+  m_dirty = false;
+  return true;
+}
+
+QByteArray CJobCache::hashFile( const QString &path )
+{
+  QFile file( path );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return QByteArray();
+
+  CContentHash hash;
+
+  // prefer mapping the file, this avoids copying it through a buffer
+  uchar *data = file.size() > 0 ? file.map( 0, file.size() ) : NULL;
+  if( data != NULL )
+  {
+    hash.addData( data, file.size() );
+    file.unmap( data );
+  }
+  else
+  {
+    while( !file.atEnd() )
+    {
+      QByteArray block = file.read( HASH_BLOCK );
+      hash.addData( reinterpret_cast<const uchar*>( block.constData() ), block.size() );
+    }
+  }
+
+  return hash.result();
+}
+
+qint64 CJobCache::modificationTime( const QFileInfo &info )
+{
+  // QFileInfo only has seconds, which miss a frame rewritten within the same second
+#ifdef Q_OS_UNIX
+  struct stat st;
+  QByteArray path = QFile::encodeName( info.absoluteFilePath() );
+  if( ::stat( path.constData(), &st ) == 0 )
+  {
+#ifdef Q_OS_MAC
+    return qint64( st.st_mtimespec.tv_sec ) * 1000 + st.st_mtimespec.tv_nsec / 1000000;
+#else
+    return qint64( st.st_mtim.tv_sec ) * 1000 + st.st_mtim.tv_nsec / 1000000;
+#endif
+  }
+#endif
+  return info.lastModified().toMSecsSinceEpoch();
+}
+
+QByteArray CJobCache::frameKey( unsigned int seqNo ) const
+{
+  // the timecode depends on the position in the sequence
+  return m_settingsKey + QByteArray::number( seqNo );
+}
+
+void CJobCache::load()
+{
+  QFile file( m_path );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return;
+
+  QDataStream stream( &file );
+  quint32 magic, version, count;
+  stream >> magic >> version >> count;
+
+  // ignore unknown or outdated caches, they get rewritten on save
+  if( magic != CACHE_MAGIC || version != CACHE_VERSION )
+    return;
+
+  for( quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++ )
+  {
+    QString name;
+    Entry entry;
+    stream >> name >> entry.inputSize >> entry.inputTime >> entry.contentHash
+           >> entry.frameKey >> entry.outputSize >> entry.outputTime;
+    if( stream.status() == QDataStream::Ok )
+      m_entries.insert( name, entry );
+  }
+}
@@ -0,0 +1,87 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CJOBCACHE_H
+#define CJOBCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QFileInfo>
+
+//! remembers which output frames are up to date with their input and settings
+/*!
+ * The cache lives as a small file inside the output directory. Every entry
+ * is keyed by the output file name and stores the input's size, time stamp
+ * and content hash together with a key derived from the overlay settings and
+ * the sequence number. As long as size and time stamp of the input are
+ * unchanged the content is not hashed again, so an unchanged job only costs
+ * a couple of stat() calls per frame.
+ */
+class CJobCache
+{
+public:
+  CJobCache( const QString &outputDir, const QByteArray &settingsKey );
+  ~CJobCache();
+
+  //! check whether output was produced from input with the current settings
+  bool isUpToDate( const QFileInfo &input, unsigned int seqNo, const QString &output );
+  //! record that output has just been written from input
+  void update( const QFileInfo &input, unsigned int seqNo, const QString &output );
+  //! write the cache file to the output directory
+  bool save();
+
+  //! name of the cache file inside the output directory
+  static const char *fileName();
+
+private:
+  //! one cached frame
+  struct Entry
+  {
+    qint64     inputSize;
+    qint64     inputTime;
+    QByteArray contentHash;
+    QByteArray frameKey;
+    qint64     outputSize;
+    qint64     outputTime;
+  };
+
+  //! fast hash over the contents of a file (memory mapped if possible)
+  static QByteArray hashFile( const QString &path );
+  //! time stamp of a file in milliseconds
+  static qint64 modificationTime( const QFileInfo &info );
+  //! key for a single frame (settings + sequence number)
+  QByteArray frameKey( unsigned int seqNo ) const;
+  //! read the cache file from the output directory
+  void load();
+
+  //! the full path to the cache file
+  QString m_path;
+  //! fingerprint of the overlay settings
+  QByteArray m_settingsKey;
+  //! all known entries, keyed by output file name
+  QHash<QString, Entry> m_entries;
+  //! to avoid needless writes
+  bool m_dirty;
+};
+
+#endif // CJOBCACHE_H
@@ -0,0 +1,341 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QThread>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSet>
+
+#include "cjobqueue.h"
+#include "ctimecodejob.h"
+
+//! worker thread, stamps frames until the queue runs dry
+class CJobWorker : public QThread
+{
+public:
+  CJobWorker( CJobQueue *queue, int slot, const CWorkerPlacement &placement )
+    : m_queue( queue ), m_slot( slot ), m_placement( placement ) {}
+
+  //! number of this worker, decides its cpus
+  int slot() const { return m_slot; }
+
+protected:
+  void run()
+  {
+    int id, index;
+    CTimecodeJob *job;
+
+    // before the first frame, so its buffers are allocated on our node
+    m_placement.bindCurrentThread( m_slot );
+
+    while( m_queue->takeFrame( id, job, index ) )
+      m_queue->frameDone( id, index, job->processFrame( index, &m_queue->m_token ) );
+  }
+
+private:
+  CJobQueue *m_queue;
+  int m_slot;
+  CWorkerPlacement m_placement;
+};
+
+CJobQueue::CJobQueue( QObject *parent )
+  : QObject( parent ), m_workerCount( 0 ), m_activeWorkers( 0 ), m_nextJob( 0 ),
+  m_inFlight( 0 ), m_running( false ), m_cancelled( false ), m_resume( false )
+{
+}
+
+CJobQueue::~CJobQueue()
+{
+  cancel();
+
+  // wait for running frames to finish
+  foreach( CJobWorker *worker, m_workers )
+  {
+    worker->wait();
+    delete worker;
+  }
+
+  for( int i = 0; i < m_jobs.size(); i++ )
+    delete m_jobs[i].job;
+}
+
+int CJobQueue::enqueue( CTimecodeJob *job )
+{
+  // every output directory holds one job cache file, two jobs writing it would clobber each other
+  QString output = outputKey( job->outputDir() );
+  {
+    QMutexLocker lock( &m_mutex );
+    for( int i = 0; i < m_jobs.size(); i++ )
+      if( outputKey( m_jobs[i].job->outputDir() ) == output )
+      {
+        delete job;
+        return -1;
+      }
+  }
+
+  // list the frames before any worker sees the job
+  job->scan();
+
+  Entry entry;
+  entry.job    = job;
+  entry.next   = 0;
+  entry.done   = 0;
+  entry.failed = 0;
+
+  int id;
+  bool running;
+  {
+    QMutexLocker lock( &m_mutex );
+    id = m_jobs.size();
+    m_jobs.append( entry );
+    running = m_running && !m_cancelled;
+  }
+
+  emit jobProgress( id, 0, job->frameCount() );
+
+  if( job->frameCount() == 0 )
+    emit jobFinished( id );
+  else if( running )
+    startWorkers();
+
+  return id;
+}
+
+QString CJobQueue::outputKey( const QString &dir )
+{
+  // resolve links if the directory exists already
+  QFileInfo info( dir );
+  QString path = info.canonicalFilePath();
+  if( path.isEmpty() )
+    path = QDir::cleanPath( info.absoluteFilePath() );
+  return path;
+}
+
+CTimecodeJob *CJobQueue::job( int id ) const
+{
+  QMutexLocker lock( &m_mutex );
+  return m_jobs.at( id ).job;
+}
+
+int CJobQueue::jobCount() const
+{
+  QMutexLocker lock( &m_mutex );
+  return m_jobs.size();
+}
+
+bool CJobQueue::isRunning() const
+{
+  QMutexLocker lock( &m_mutex );
+  return m_running;
+}
+
+void CJobQueue::setPlacement( const CWorkerPlacement &placement )
+{
+  QMutexLocker lock( &m_mutex );
+  m_placement = placement;
+}
+
+void CJobQueue::start( int workers )
+{
+  bool running;
+
+  {
+    QMutexLocker lock( &m_mutex );
+    // cpusets may leave fewer cpus than the machine has
+    int cpus = m_placement.cpuCount() > 0 ? m_placement.cpuCount() : QThread::idealThreadCount();
+    m_workerCount = workers > 0 ? workers : cpus;
+    if( m_workerCount < 1 )
+      m_workerCount = 1;
+
+    // frames of the cancelled run still check the token, the last one resumes
+    if( m_cancelled && m_inFlight > 0 )
+    {
+      m_resume = true;
+      return;
+    }
+
+    m_cancelled = false;
+    m_token.reset();
+
+    // nothing to do at all
+    m_running = m_inFlight > 0 || hasPendingFrames();
+    running = m_running;
+  }
+
+  if( running )
+    startWorkers();
+  else
+    emit finished();
+}
+
+void CJobQueue::cancel()
+{
+  // abort running frames at their next check
+  m_token.cancel();
+
+  bool idle;
+
+  {
+    QMutexLocker lock( &m_mutex );
+
+    // frames not handed out yet stay where they are for the next start()
+    m_cancelled = true;
+    m_resume = false;
+
+    // no frame left to report the end of the run
+    idle = m_running && m_inFlight == 0;
+    if( idle )
+      m_running = false;
+  }
+
+  if( idle )
+    runFinished();
+}
+
+bool CJobQueue::takeFrame( int &id, CTimecodeJob *&job, int &index )
+{
+  QMutexLocker lock( &m_mutex );
+
+  // look for a job with pending frames, starting after the one served last
+  for( int i = 0; i < m_jobs.size() && !m_cancelled; i++ )
+  {
+    int candidate = (m_nextJob + i) % m_jobs.size();
+    Entry &entry = m_jobs[candidate];
+
+    if( !entry.retry.isEmpty() || entry.next < entry.job->frameCount() )
+    {
+      id    = candidate;
+      job   = entry.job;
+      index = entry.retry.isEmpty() ? entry.next++ : entry.retry.takeFirst();
+      m_nextJob = candidate + 1;
+      m_inFlight++;
+      return true;
+    }
+  }
+
+  // nothing left, the worker is going to exit
+  m_activeWorkers--;
+  return false;
+}
+
+void CJobQueue::frameDone( int id, int index, bool ok )
+{
+  bool jobDone, allDone, resume = false;
+  int done, total;
+  CTimecodeJob *job;
+
+  {
+    QMutexLocker lock( &m_mutex );
+    Entry &entry = m_jobs[id];
+
+    if( ok )
+      entry.done++;
+    else if( m_cancelled )
+      entry.retry.append( index );  // aborted, not broken
+    else
+      entry.failed++;
+    m_inFlight--;
+
+    job     = entry.job;
+    done    = entry.done + entry.failed;
+    total   = job->frameCount();
+    jobDone = done == total;
+
+    // the cancelled run is over, start() asked for the next one meanwhile
+    if( m_inFlight == 0 && m_cancelled && m_resume )
+    {
+      m_cancelled = false;
+      m_resume    = false;
+      m_token.reset();
+      resume = hasPendingFrames();
+    }
+
+    // a cancelled run is over once its last running frame returns
+    allDone = m_inFlight == 0 && !resume && (m_cancelled || !hasPendingFrames());
+    if( allDone )
+      m_running = false;
+  }
+
+  // workers belong to the gui thread
+  if( resume )
+    QMetaObject::invokeMethod( this, "startWorkers", Qt::QueuedConnection );
+
+  emit jobProgress( id, done, total );
+
+  if( jobDone )
+  {
+    job->saveCache();
+    emit jobFinished( id );
+  }
+
+  if( allDone )
+    runFinished();
+}
+
+void CJobQueue::runFinished()
+{
+  // keep what has been done so far, also for cancelled jobs
+  for( int i = 0; i < jobCount(); i++ )
+    job( i )->saveCache();
+  emit finished();
+}
+
+void CJobQueue::startWorkers()
+{
+  QMutexLocker lock( &m_mutex );
+
+  // clean up workers that ran dry before
+  for( int i = m_workers.size() - 1; i >= 0; i-- )
+  {
+    if( m_workers[i]->isFinished() )
+      delete m_workers.takeAt( i );
+  }
+
+  // slots of workers still around, replacements take the free ones
+  QSet<int> taken;
+  foreach( CJobWorker *worker, m_workers )
+    taken.insert( worker->slot() );
+
+  int slot = 0;
+  while( m_activeWorkers < m_workerCount )
+  {
+    while( taken.contains( slot ) )
+      slot++;
+    taken.insert( slot );
+
+    CJobWorker *worker = new CJobWorker( this, slot, m_placement );
+    m_workers.append( worker );
+    m_activeWorkers++;
+    worker->start();
+  }
+}
+
+bool CJobQueue::hasPendingFrames() const
+{
+  for( int i = 0; i < m_jobs.size(); i++ )
+  {
+    if( !m_jobs[i].retry.isEmpty() || m_jobs[i].next < m_jobs[i].job->frameCount() )
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,141 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CJOBQUEUE_H
+#define CJOBQUEUE_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+
+#include "ccanceltoken.h"
+#include "cworkerplacement.h"
+
+class CTimecodeJob;
+class CJobWorker;
+
+//! runs several timecode jobs concurrently on one pool of worker threads
+/*!
+ * Workers pick frames from the jobs in round robin order, so every job
+ * makes progress at the same pace regardless of its size. Signals are
+ * emitted from the worker threads and thus arrive queued in the gui.
+ *
+ * A worker decodes, stamps and encodes a frame on its own, so binding the
+ * workers with CWorkerPlacement keeps every frame on one NUMA node.
+ *
+ * Workers do not render fonts: the glyphs are rasterized when a job is
+ * created and held by it, text that has to be painted with QPainter is
+ * painted by the gui thread where fonts can not be rendered elsewhere.
+ */
+class CJobQueue : public QObject
+{
+  Q_OBJECT
+
+public:
+  CJobQueue( QObject *parent = 0 );
+  ~CJobQueue();
+
+  //! append a job (takes ownership), returns the job id
+  /*!
+   * Returns -1 and deletes the job if another job already writes to the
+   * same output directory, they would share the job cache file there.
+   */
+  int enqueue( CTimecodeJob *job );
+  //! the job with the given id
+  CTimecodeJob *job( int id ) const;
+  //! number of jobs enqueued so far
+  int jobCount() const;
+  //! whether workers are busy
+  bool isRunning() const;
+
+  //! how workers started from now on are bound to cpus
+  void setPlacement( const CWorkerPlacement &placement );
+
+  //! start processing with the given number of workers (0 = one per usable cpu)
+  void start( int workers = 0 );
+  //! stop handing out frames and abort running ones, start() resumes with the unfinished frames
+  void cancel();
+
+signals:
+  //! progress of a single job
+  void jobProgress( int id, int done, int total );
+  //! a job has no more frames left
+  void jobFinished( int id );
+  //! all jobs are done (or cancelled)
+  void finished();
+
+private slots:
+  //! spawn workers up to the configured count
+  void startWorkers();
+
+private:
+  friend class CJobWorker;
+
+  //! bookkeeping for one job
+  struct Entry
+  {
+    CTimecodeJob *job;
+    int next;
+    int done;
+    int failed;
+    //! frames aborted by a cancel, handed out again first
+    QList<int> retry;
+  };
+
+  //! hand out the next frame, returns false if there is nothing left
+  bool takeFrame( int &id, CTimecodeJob *&job, int &index );
+  //! called by workers when a frame is done
+  void frameDone( int id, int index, bool ok );
+  //! save the caches and report the end of a run
+  void runFinished();
+  //! output directory as compared between jobs
+  static QString outputKey( const QString &dir );
+  //! whether any frame has not been handed out yet (mutex must be held)
+  bool hasPendingFrames() const;
+
+  //! all jobs in order of enqueueing
+  QList<Entry> m_jobs;
+  //! the worker threads
+  QList<CJobWorker*> m_workers;
+  //! number of workers to run
+  int m_workerCount;
+  //! binds workers to cpus
+  CWorkerPlacement m_placement;
+  //! number of workers still asking for frames
+  int m_activeWorkers;
+  //! job to look at first when handing out frames (round robin)
+  int m_nextJob;
+  //! frames handed out but not done yet
+  int m_inFlight;
+  //! between start() and finished()
+  bool m_running;
+  //! between cancel() and start(), no frames are handed out
+  bool m_cancelled;
+  //! start() was called while cancelled frames were still running
+  bool m_resume;
+  //! protects everything above
+  mutable QMutex m_mutex;
+  //! aborts running frames on cancel
+  CCancelToken m_token;
+};
+
+#endif // CJOBQUEUE_H
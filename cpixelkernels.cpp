@@ -0,0 +1,288 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include "cpixelkernels.h"
+
+// vector kernels are built for x86 with gcc or clang, whatever the compiler flags say
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// x * a / 255 for two channels at once, rounded like the raster engine does
+static inline unsigned int byteMul( unsigned int x, unsigned int a )
+{
+  unsigned int t = (x & 0xff00ff) * a;
+  t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+  t &= 0xff00ff;
+
+  x = ((x >> 8) & 0xff00ff) * a;
+  x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+  x &= 0xff00ff00;
+
+  return x | t;
+}
+
+// premultiply a 0xAARRGGBB pixel
+static inline unsigned int premultiply( unsigned int x )
+{
+  unsigned int a = x >> 24;
+  return (byteMul( x, a ) & 0x00ffffff) | (a << 24);
+}
+
+// undo premultiplication of a 0xAARRGGBB pixel
+static inline unsigned int unpremultiply( unsigned int p )
+{
+  unsigned int a = p >> 24;
+  if( a == 0 )
+    return 0;
+
+  unsigned int r = ((p >> 16) & 0xff) * 255 / a;
+  unsigned int g = ((p >>  8) & 0xff) * 255 / a;
+  unsigned int b = ( p        & 0xff) * 255 / a;
+  return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// premultiplied source over premultiplied destination
+static inline unsigned int sourceOver( unsigned int d, unsigned int s )
+{
+  return s + byteMul( d, 255 - (s >> 24) );
+}
+
+// remainder of a row (or all of it without vector kernels)
+static void blendPremultipliedGeneric( unsigned int *dst, const unsigned int *src, int count )
+{
+  for( int i = 0; i < count; i++ )
+  {
+    unsigned int alpha = src[i] >> 24;
+    if( alpha == 255 )
+      dst[i] = src[i];
+    else if( src[i] != 0 )
+      dst[i] = sourceOver( dst[i], src[i] );
+  }
+}
+
+#ifdef KERNELS_X86
+
+__attribute__(( target( "sse2" ) ))
+static void blendPremultipliedSSE2( unsigned int *dst, const unsigned int *src, int count )
+{
+  const __m128i mask  = _mm_set1_epi32( 0x00ff00ff );
+  const __m128i c255  = _mm_set1_epi16( 255 );
+  const __m128i round = _mm_set1_epi16( 0x80 );
+  const __m128i zero  = _mm_setzero_si128();
+
+  int i = 0;
+  for( ; i + 4 <= count; i += 4 )
+  {
+    __m128i s = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+
+    // nothing to do for fully transparent parts of the badge
+    if( _mm_movemask_epi8( _mm_cmpeq_epi32( s, zero ) ) == 0xffff )
+      continue;
+
+    __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>( dst + i ) );
+
+    // inverse source alpha in both 16 bit halves of every pixel
+    __m128i a  = _mm_srli_epi32( s, 24 );
+    __m128i ia = _mm_sub_epi16( c255, _mm_or_si128( a, _mm_slli_epi32( a, 16 ) ) );
+
+    // blue/red and alpha/green in separate 16 bit lanes
+    __m128i lo = _mm_mullo_epi16( _mm_and_si128( d, mask ), ia );
+    __m128i hi = _mm_mullo_epi16( _mm_srli_epi16( d, 8 ), ia );
+
+    lo = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( lo, _mm_srli_epi16( lo, 8 ) ), round ), 8 );
+    hi = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( hi, _mm_srli_epi16( hi, 8 ) ), round ), 8 );
+
+    d = _mm_or_si128( lo, _mm_slli_epi16( hi, 8 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), _mm_add_epi32( s, d ) );
+  }
+
+  blendPremultipliedGeneric( dst + i, src + i, count - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void blendPremultipliedAVX2( unsigned int *dst, const unsigned int *src, int count )
+{
+  const __m256i mask  = _mm256_set1_epi32( 0x00ff00ff );
+  const __m256i c255  = _mm256_set1_epi16( 255 );
+  const __m256i round = _mm256_set1_epi16( 0x80 );
+
+  int i = 0;
+  for( ; i + 8 <= count; i += 8 )
+  {
+    __m256i s = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + i ) );
+
+    // nothing to do for fully transparent parts of the badge
+    if( _mm256_testz_si256( s, s ) )
+      continue;
+
+    __m256i d = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( dst + i ) );
+
+    // inverse source alpha in both 16 bit halves of every pixel
+    __m256i a  = _mm256_srli_epi32( s, 24 );
+    __m256i ia = _mm256_sub_epi16( c255, _mm256_or_si256( a, _mm256_slli_epi32( a, 16 ) ) );
+
+    // blue/red and alpha/green in separate 16 bit lanes
+    __m256i lo = _mm256_mullo_epi16( _mm256_and_si256( d, mask ), ia );
+    __m256i hi = _mm256_mullo_epi16( _mm256_srli_epi16( d, 8 ), ia );
+
+    lo = _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( lo, _mm256_srli_epi16( lo, 8 ) ), round ), 8 );
+    hi = _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( hi, _mm256_srli_epi16( hi, 8 ) ), round ), 8 );
+
+    d = _mm256_or_si256( lo, _mm256_slli_epi16( hi, 8 ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + i ), _mm256_add_epi32( s, d ) );
+  }
+
+  blendPremultipliedGeneric( dst + i, src + i, count - i );
+}
+
+#endif // KERNELS_X86
+
+// the instruction set in use, picked on first use
+static CPixelKernels::InstructionSet s_instructionSet = CPixelKernels::InstructionSet( -1 );
+
+static CPixelKernels::InstructionSet activeInstructionSet()
+{
+  // concurrent first calls all come to the same result
+  if( s_instructionSet < 0 )
+    s_instructionSet = CPixelKernels::bestInstructionSet();
+  return s_instructionSet;
+}
+
+CPixelKernels::InstructionSet CPixelKernels::bestInstructionSet()
+{
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx2" ) )
+    return AVX2;
+  if( __builtin_cpu_supports( "sse2" ) )
+    return SSE2;
+#endif
+  return Generic;
+}
+
+bool CPixelKernels::setInstructionSet( InstructionSet set )
+{
+  // never pick something the cpu can not run
+  if( set > bestInstructionSet() )
+    return false;
+
+  s_instructionSet = set;
+  return true;
+}
+
+void CPixelKernels::blendPremultiplied( unsigned int *dst, const unsigned int *src, int count )
+{
+  switch( activeInstructionSet() )
+  {
+#ifdef KERNELS_X86
+  case AVX2:
+    blendPremultipliedAVX2( dst, src, count );
+    return;
+  case SSE2:
+    blendPremultipliedSSE2( dst, src, count );
+    return;
+#endif
+  default:
+    blendPremultipliedGeneric( dst, src, count );
+  }
+}
+
+void CPixelKernels::blendARGB32( unsigned int *dst, const unsigned int *src, int count )
+{
+  for( int i = 0; i < count; i++ )
+  {
+    if( src[i] == 0 )
+      continue;
+
+    // opaque destinations need no conversion at all
+    if( (dst[i] >> 24) == 255 )
+      dst[i] = sourceOver( dst[i], src[i] );
+    else
+      dst[i] = unpremultiply( sourceOver( premultiply( dst[i] ), src[i] ) );
+  }
+}
+
+void CPixelKernels::blendRGB16( unsigned short *dst, const unsigned int *src, int count, int channels )
+{
+  for( int i = 0; i < count; i++, dst += channels )
+  {
+    unsigned int s = src[i];
+    if( s == 0 )
+      continue;
+
+    // widen the badge to 16 bit (premultiplied)
+    unsigned int sa = (s >> 24) * 257;
+    unsigned int sc[3] = { ((s >> 16) & 0xff) * 257, ((s >> 8) & 0xff) * 257, (s & 0xff) * 257 };
+    unsigned int ia = 65535 - sa;
+
+    if( channels == 3 )
+    {
+      for( int c = 0; c < 3; c++ )
+        dst[c] = sc[c] + (dst[c] * ia + 32767) / 65535;
+      continue;
+    }
+
+    // non-premultiplied destination with alpha
+    unsigned int da   = dst[3];
+    unsigned int outA = sa + (da * ia + 32767) / 65535;
+    for( int c = 0; c < 3; c++ )
+    {
+      unsigned long long dc = (unsigned long long)dst[c] * da / 65535;
+      unsigned long long oc = sc[c] + (dc * ia + 32767) / 65535;
+      oc = outA ? oc * 65535 / outA : 0;
+      dst[c] = oc > 65535 ? 65535 : oc;
+    }
+    dst[3] = outA;
+  }
+}
+
+void CPixelKernels::convertIndexed8( unsigned int *dst, const unsigned char *src,
+                                     const unsigned int *colorTable, int count )
+{
+  int i = 0;
+
+  // a table lookup does not vectorize well, unroll instead
+  for( ; i + 4 <= count; i += 4 )
+  {
+    dst[i    ] = colorTable[src[i    ]];
+    dst[i + 1] = colorTable[src[i + 1]];
+    dst[i + 2] = colorTable[src[i + 2]];
+    dst[i + 3] = colorTable[src[i + 3]];
+  }
+  for( ; i < count; i++ )
+    dst[i] = colorTable[src[i]];
+}
+
+const char *CPixelKernels::instructionSet()
+{
+  switch( activeInstructionSet() )
+  {
+  case AVX2:
+    return "AVX2";
+  case SSE2:
+    return "SSE2";
+  default:
+    return "generic";
+  }
+}
@@ -0,0 +1,63 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CPIXELKERNELS_H
+#define CPIXELKERNELS_H
+
+//! row kernels to blend the pre-rendered badge into frames of any format
+/*!
+ * The source is always a row of premultiplied 0xAARRGGBB pixels (the badge),
+ * the destination is a row of the frame in its native format. Rounding
+ * follows the raster paint engine, so results match QPainter's source over.
+ * SSE2 and AVX2 versions are picked at runtime by what the cpu supports,
+ * the scalar versions handle the remainder and all other targets.
+ */
+class CPixelKernels
+{
+public:
+  //! vector extensions the kernels can use (in ascending order)
+  enum InstructionSet
+  {
+    Generic,  //!< plain C++
+    SSE2,     //!< 4 pixels at once
+    AVX2      //!< 8 pixels at once
+  };
+
+  //! source over RGB32 or ARGB32_Premultiplied pixels
+  static void blendPremultiplied( unsigned int *dst, const unsigned int *src, int count );
+  //! source over non-premultiplied ARGB32 pixels
+  static void blendARGB32( unsigned int *dst, const unsigned int *src, int count );
+  //! source over 16 bit per channel RGB (channels = 3) or RGBA (channels = 4) pixels
+  static void blendRGB16( unsigned short *dst, const unsigned int *src, int count, int channels );
+  //! expand 8 bit indexed pixels (e.g. grayscale) to 32 bit using the color table
+  static void convertIndexed8( unsigned int *dst, const unsigned char *src,
+                               const unsigned int *colorTable, int count );
+
+  //! name of the instruction set the kernels use
+  static const char *instructionSet();
+  //! best instruction set the cpu supports
+  static InstructionSet bestInstructionSet();
+  //! restrict the kernels to set (e.g. for comparisons), fails if the cpu lacks it
+  static bool setInstructionSet( InstructionSet set );
+};
+
+#endif // CPIXELKERNELS_H
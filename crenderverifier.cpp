@@ -0,0 +1,553 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QApplication>
+#include <QDesktopWidget>
+#include <QDir>
+#include <QFile>
+#include <QFont>
+#include <QPixmap>
+#include <QPainter>
+#include <QGraphicsSimpleTextItem>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSet>
+#include <QVector>
+#include <QtGlobal>
+#include <sstream>
+
+#include "crenderverifier.h"
+#include "ctimecoderenderer.h"
+#include "cstriprenderer.h"
+#include "cglyphcache.h"
+#include "cpixelkernels.h"
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#include <cstdio>
+#endif
+
+// size of the synthetic frames
+#define FRAME_WIDTH  320
+#define FRAME_HEIGHT 200
+
+#ifdef HAVE_LIBPNG
+
+// write the synthetic frame as png of the kind path streams (16 bit, gray, palette)
+static bool writeInput( const QString &file, CRenderVerifier::Path path, const QImage &frame )
+{
+  int colorType, depth = 8, channels;
+  switch( path )
+  {
+  case CRenderVerifier::StripRGB16:        colorType = PNG_COLOR_TYPE_RGB;        depth = 16; channels = 3; break;
+  case CRenderVerifier::StripRGBA16:       colorType = PNG_COLOR_TYPE_RGB_ALPHA;  depth = 16; channels = 4; break;
+  case CRenderVerifier::StripGray:         colorType = PNG_COLOR_TYPE_GRAY;       channels = 1; break;
+  case CRenderVerifier::StripGrayAlpha:    colorType = PNG_COLOR_TYPE_GRAY_ALPHA; channels = 2; break;
+  case CRenderVerifier::StripPalette:
+  case CRenderVerifier::StripPaletteAlpha: colorType = PNG_COLOR_TYPE_PALETTE;    channels = 1; break;
+  default:
+    return false;
+  }
+
+  QByteArray name = QFile::encodeName( file );
+  FILE *out = fopen( name.constData(), "wb" );
+  if( out == NULL )
+    return false;
+
+  png_structp png = png_create_write_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  png_infop info = png ? png_create_info_struct( png ) : NULL;
+  if( info == NULL || setjmp( png_jmpbuf( png ) ) )
+  {
+    png_destroy_write_struct( &png, info ? &info : NULL );
+    fclose( out );
+    return false;
+  }
+
+  png_init_io( png, out );
+  png_set_IHDR( png, info, frame.width(), frame.height(), depth, colorType,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT );
+  png_set_pHYs( png, info, frame.dotsPerMeterX(), frame.dotsPerMeterY(), PNG_RESOLUTION_METER );
+
+  // a palette of its own, index i has color i (and alpha i with transparency)
+  png_color palette[256];
+  png_byte transparency[256];
+  for( int i = 0; i < 256; i++ )
+  {
+    palette[i].red   = i;
+    palette[i].green = 255 - i;
+    palette[i].blue  = (i * 7) & 0xff;
+    transparency[i]  = i;
+  }
+  if( colorType == PNG_COLOR_TYPE_PALETTE )
+    png_set_PLTE( png, info, palette, 256 );
+  if( path == CRenderVerifier::StripPaletteAlpha )
+    png_set_tRNS( png, info, transparency, 256, NULL );
+
+  png_write_info( png, info );
+
+  QVector<png_byte> row( frame.width() * channels * depth / 8 );
+  for( int y = 0; y < frame.height(); y++ )
+  {
+    const QRgb *line = reinterpret_cast<const QRgb*>( frame.scanLine( y ) );
+    png_bytep p = row.data();
+
+    for( int x = 0; x < frame.width(); x++ )
+    {
+      QRgb c = line[x];
+      if( depth == 16 )
+      {
+        // big endian, the low byte carries detail 8 bit frames do not have
+        int values[4] = { qRed( c ), qGreen( c ), qBlue( c ), qAlpha( c ) };
+        for( int i = 0; i < channels; i++ )
+        {
+          *p++ = values[i];
+          *p++ = (x * 31 + y * 17 + i * 5) & 0xff;
+        }
+      }
+      else if( colorType == PNG_COLOR_TYPE_PALETTE )
+        *p++ = (x + y * 3) & 0xff;
+      else
+      {
+        *p++ = qGray( c );
+        if( channels == 2 )
+          *p++ = qAlpha( c );
+      }
+    }
+
+    png_write_row( png, row.data() );
+  }
+
+  png_write_end( png, NULL );
+  png_destroy_write_struct( &png, &info );
+  return fclose( out ) == 0;
+}
+
+#endif // HAVE_LIBPNG
+
+CRenderVerifier::CRenderVerifier( int tolerance, const QString &goldenDir )
+  : m_tolerance( tolerance ), m_goldenDir( goldenDir ),
+  m_tempDir( QDir::tempPath() + "/timecode4-verify-" + QString::number( QApplication::applicationPid() ) )
+{
+  QDir().mkpath( m_tempDir );
+
+  // the glyphs of the cases must neither end up in nor push out the user's cache
+  CGlyphCache::setCacheDir( m_tempDir + "/glyphs" );
+}
+
+CRenderVerifier::~CRenderVerifier()
+{
+  CGlyphCache::setCacheDir( QString() );
+
+  // leave nothing behind
+  QDir glyphs( m_tempDir + "/glyphs" );
+  foreach( const QString &name, glyphs.entryList( QDir::Files ) )
+    glyphs.remove( name );
+  QDir().rmdir( glyphs.path() );
+
+  QDir dir( m_tempDir );
+  foreach( const QString &name, dir.entryList( QDir::Files ) )
+    dir.remove( name );
+  QDir().rmdir( m_tempDir );
+}
+
+QList<CRenderVerifier::Case> CRenderVerifier::cases()
+{
+  // point and pixel sized fonts, plain and bold
+  QList<QFont> fonts;
+  fonts << QApplication::font();
+  fonts << QFont( "Courier", 12 );
+  fonts << QFont( "Sans", 20, QFont::Bold );
+  QFont pixelFont( "Serif" );
+  pixelFont.setPixelSize( 36 );
+  fonts << pixelFont;
+
+  // opaque, dark on bright and half transparent colors
+  QList<QColor> textColors, frameColors;
+  textColors  << Qt::white << Qt::black << QColor( 255, 32, 16 ) << QColor( 16, 255, 64, 128 );
+  frameColors << Qt::black << Qt::white << QColor( 0, 64, 255 ) << QColor( 200, 200, 0, 90 );
+
+  // corners and clipping at every edge
+  QList<QPoint> positions;
+  positions << QPoint( 0, 0 ) << QPoint( 17, 33 ) << QPoint( FRAME_WIDTH - 40, FRAME_HEIGHT - 12 )
+            << QPoint( -25, -8 ) << QPoint( 3, FRAME_HEIGHT - 30 );
+
+  QList<double> framerates;
+  framerates << 25.0 << 29.97 << 60.0 << 23.976;
+
+  QList<unsigned int> seqNos;
+  seqNos << 0 << 1 << 1799 << 123457 << 8639999 << 44 << 900;
+
+  // 72, 96 and 300 dpi must not change the text size
+  QList<int> resolutions;
+  resolutions << 2835 << 3780 << 11811;
+
+  // fonts and colors are crossed, the other parameters cycle with lengths
+  // coprime to 4, so every color meets every position, framerate, ...
+  QList<Case> result;
+  foreach( const QFont &font, fonts )
+  {
+    foreach( const QColor &textColor, textColors )
+    {
+      foreach( const QColor &frameColor, frameColors )
+      {
+        int n = result.size();
+
+        Case c;
+        c.settings.font       = font;
+        c.settings.textColor  = textColor;
+        c.settings.frameColor = frameColor;
+        c.settings.posX       = positions[n % positions.size()].x();
+        c.settings.posY       = positions[n % positions.size()].y();
+        c.settings.framerate  = framerates[(n / 5) % framerates.size()];
+        // point sizes refer to the screen, like in the preview and on the baseline's pixmaps
+        c.settings.dpi        = QApplication::desktop()->logicalDpiY();
+        c.settings.updateBadgeSize();
+        c.seqNo               = seqNos[n % seqNos.size()];
+        c.dotsPerMeter        = resolutions[n % resolutions.size()];
+        result << c;
+      }
+    }
+  }
+
+  return result;
+}
+
+QString CRenderVerifier::caseName( const Case &c )
+{
+  return QString( "%1 %2 %3/%4 at %5,%6 %7dpm" )
+         .arg( CTimecodeRenderer::timecode( c.seqNo, c.settings.framerate ) )
+         .arg( c.settings.font.family() )
+         .arg( c.settings.textColor.name() ).arg( c.settings.frameColor.name() )
+         .arg( c.settings.posX ).arg( c.settings.posY ).arg( c.dotsPerMeter );
+}
+
+QString CRenderVerifier::pathName( Path path )
+{
+  const char *names[PathCount] = { "paint rgb32", "paint argb32", "paint argb32pm", "frame indexed8",
+                                   "strip rgb", "strip rgba", "strip rgb16", "strip rgba16",
+                                   "strip gray", "strip gray+alpha", "strip palette", "strip palette+trns" };
+  return names[path];
+}
+
+bool CRenderVerifier::isAvailable( Path path )
+{
+#ifdef HAVE_LIBPNG
+  Q_UNUSED( path );
+  return true;
+#else
+  return path < StripRGB;
+#endif
+}
+
+bool CRenderVerifier::check( const Case &c, Path path, QString &message )
+{
+  QString file   = m_tempDir + "/input.png";
+  QString output = m_tempDir + "/output.png";
+  int tolerance = m_tolerance;
+
+  if( !isAvailable( path ) )
+  {
+    message = "not available without libpng";
+    return false;
+  }
+
+  QImage source = input( c, path, file );
+  if( source.isNull() )
+  {
+    message = "could not write the input";
+    return false;
+  }
+
+  QImage result;
+  switch( path )
+  {
+  case PaintRGB32:
+  case PaintARGB32:
+  case PaintPremultiplied:
+    // glyph cache and pixel kernels
+    result = source;
+    CTimecodeRenderer::paint( result, c.settings, c.seqNo );
+    break;
+
+  case FrameIndexed8:
+    // the whole pipeline, from an indexed frame to the encoded png
+    if( CTimecodeRenderer::processFrame( source, output, c.settings, c.seqNo ) )
+      result.load( output );
+    break;
+
+  default:
+    // Qt reads 16 bit files with the low byte cut off, blending before that rounds once more
+    if( path == StripRGB16 || path == StripRGBA16 )
+    {
+      tolerance++;
+
+      // small as the frame is, it has to be streamed to keep its depth
+      if( !CStripRenderer::canStream( file ) )
+      {
+        message = "16 bit frame would not be streamed";
+        return false;
+      }
+    }
+
+    if( CStripRenderer::processFrame( file, output, c.settings, c.seqNo ) == CStripRenderer::Done )
+      result.load( output );
+    break;
+  }
+
+  if( result.isNull() )
+  {
+    message = "no output";
+    return false;
+  }
+
+  // the recorded golden image, the baseline painted right now if there is none
+  QImage expected;
+  bool golden = !m_goldenDir.isEmpty() && expected.load( m_goldenDir + "/" + goldenName( c, path ) );
+  if( !golden )
+    expected = reference( source, c );
+
+  int maxDiff;
+  int mismatches = compare( expected, result, tolerance, maxDiff );
+
+  message = QString( "max diff %1" ).arg( maxDiff );
+  if( mismatches > 0 )
+    message += QString( ", %1 pixels off" ).arg( mismatches );
+  if( !golden )
+    message += ", no golden image";
+
+  return mismatches == 0;
+}
+
+bool CRenderVerifier::record( const QString &dir, QTextStream &out )
+{
+  if( !QDir().mkpath( dir ) )
+  {
+    out << "can not create " << dir << endl;
+    return false;
+  }
+
+  // paths reading the same kind of input share their golden images
+  QSet<QString> written;
+  QList<Case> all = cases();
+  for( int i = 0; i < all.size(); i++ )
+  {
+    for( int path = 0; path < PathCount; path++ )
+    {
+      QString name = goldenName( all[i], Path( path ) );
+      if( !isAvailable( Path( path ) ) || written.contains( name ) )
+        continue;
+
+      QImage source = input( all[i], Path( path ), m_tempDir + "/input.png" );
+      if( source.isNull() || !reference( source, all[i] ).save( dir + "/" + name, "PNG" ) )
+      {
+        out << "could not record " << name << endl;
+        return false;
+      }
+      written << name;
+    }
+  }
+
+  out << written.size() << " golden images recorded in " << dir << endl;
+  return true;
+}
+
+bool CRenderVerifier::run( QTextStream &out )
+{
+  out << "verifying overlay paths (" << CPixelKernels::instructionSet()
+      << ", tolerance " << m_tolerance << ")" << endl;
+
+  int failed = 0, checks = 0;
+  QList<Case> all = cases();
+
+  for( int i = 0; i < all.size(); i++ )
+  {
+    for( int path = 0; path < PathCount; path++ )
+    {
+      if( !isAvailable( Path( path ) ) )
+        continue;
+
+      QString message;
+      bool ok = check( all[i], Path( path ), message );
+
+      out << (ok ? "ok   " : "FAIL ") << "case " << i << " " << caseName( all[i] )
+          << " " << pathName( Path( path ) ) << ": " << message << endl;
+      failed += !ok;
+      checks++;
+    }
+  }
+
+  out << (checks - failed) << " of " << checks << " checks passed" << endl;
+  return failed == 0;
+}
+
+QImage CRenderVerifier::frame( QImage::Format format, int dotsPerMeter )
+{
+  QImage image( FRAME_WIDTH, FRAME_HEIGHT, QImage::Format_ARGB32 );
+  image.setDotsPerMeterX( dotsPerMeter );
+  image.setDotsPerMeterY( dotsPerMeter );
+
+  for( int y = 0; y < FRAME_HEIGHT; y++ )
+  {
+    QRgb *line = reinterpret_cast<QRgb*>( image.scanLine( y ) );
+    for( int x = 0; x < FRAME_WIDTH; x++ )
+      line[x] = qRgba( x * 7, y * 5, (x ^ y) & 0xff, (x + y) * 3 );
+  }
+
+  return image.convertToFormat( format );
+}
+
+QImage CRenderVerifier::input( const Case &c, Path path, const QString &file )
+{
+  switch( path )
+  {
+  case PaintRGB32:         return frame( QImage::Format_RGB32, c.dotsPerMeter );
+  case PaintARGB32:        return frame( QImage::Format_ARGB32, c.dotsPerMeter );
+  case PaintPremultiplied: return frame( QImage::Format_ARGB32_Premultiplied, c.dotsPerMeter );
+  case FrameIndexed8:      return frame( QImage::Format_RGB32, c.dotsPerMeter ).convertToFormat( QImage::Format_Indexed8 );
+  default:                 break;
+  }
+
+  // streaming works on png files of any size when called directly
+  QImage source = frame( QImage::Format_ARGB32, c.dotsPerMeter );
+  bool written;
+  if( path == StripRGB )
+    written = source.convertToFormat( QImage::Format_RGB32 ).save( file, "PNG" );
+  else if( path == StripRGBA )
+    written = source.save( file, "PNG" );
+#ifdef HAVE_LIBPNG
+  else
+    written = writeInput( file, path, source );
+#else
+  else
+    written = false;
+#endif
+
+  // loaded like a regular run would
+  return written ? QImage( file ) : QImage();
+}
+
+QString CRenderVerifier::goldenName( const Case &c, Path path )
+{
+  // Qt reads the 16 bit files 8 bit, premultiplying does not change the look
+  const char *inputs[PathCount] = { "rgb", "argb", "argb", "indexed8",
+                                    "rgb", "argb", "rgb", "argb",
+                                    "gray", "grayalpha", "palette", "palettetrns" };
+
+  // only what the case asks for, the badge size is measured by the code under test
+  QByteArray data;
+  QDataStream stream( &data, QIODevice::WriteOnly );
+  stream << c.settings.font.toString() << c.settings.framerate << (qint32)c.settings.dpi
+         << (quint32)c.settings.textColor.rgba() << (quint32)c.settings.frameColor.rgba()
+         << (qint32)c.settings.posX << (qint32)c.settings.posY
+         << (quint32)c.seqNo << (qint32)c.dotsPerMeter;
+
+  return QString( "%1-%2.png" ).arg( inputs[path] )
+         .arg( QString( QCryptographicHash::hash( data, QCryptographicHash::Md5 ).toHex().left( 16 ) ) );
+}
+
+// the timecode the way processImages() formatted it, kept apart from CTimecodeRenderer on purpose
+static QString baselineTimecode( unsigned int seqNo, double framerate )
+{
+  unsigned int secs  = static_cast<unsigned int>( seqNo / framerate );
+  unsigned int frame = static_cast<unsigned int>( seqNo - (secs*framerate ) );
+  unsigned int hour  = static_cast<unsigned int>( secs / 3600 );
+  secs -= hour * 3600;
+  unsigned int min   = static_cast<unsigned int>( secs / 60 );
+  secs -= min * 60;
+
+  std::stringstream tcstring;
+  tcstring.fill( '0' );
+  tcstring.width( 2 );
+  tcstring << hour << ":";
+  tcstring.width( 2 );
+  tcstring << min << ":";
+  tcstring.width( 2 );
+  tcstring << secs << ".";
+  tcstring.width( 2 );
+  tcstring << frame;
+
+  return QString::fromStdString( tcstring.str() );
+}
+
+QImage CRenderVerifier::reference( const QImage &input, const Case &c )
+{
+  // what processImages() did before the overlay was factored out, sharing no
+  // code with the paths under test: the frame as a pixmap, painted on with QPainter
+  QPixmap pixmap = QPixmap::fromImage( input );
+
+  QFont font = c.settings.font;
+  unsigned int fontSize = (font.pixelSize() == -1 ? font.pointSize() : font.pixelSize());
+  int x = c.settings.posX + fontSize/4;
+  int y = c.settings.posY + fontSize + fontSize/16;
+
+  // the badge is as large as the preview's sample text
+  QGraphicsSimpleTextItem sample( "03:22:43.04" );
+  sample.setFont( font );
+  unsigned int width  = sample.boundingRect().width() + fontSize/2;
+  unsigned int height = sample.boundingRect().height();
+
+  qreal radius = fontSize/5.0;
+
+  QPainter painter( &pixmap );
+
+  QColor color = c.settings.frameColor;
+  color.setAlpha( RECTALPHA );
+  painter.setBrush( QBrush( color, Qt::SolidPattern ) );
+  painter.setPen( Qt::NoPen );
+  painter.drawRoundedRect( c.settings.posX, c.settings.posY, width, height, radius, radius );
+
+  painter.setFont( font );
+  painter.setPen( c.settings.textColor );
+  painter.drawText( x, y, baselineTimecode( c.seqNo, c.settings.framerate ) );
+  painter.end();
+
+  return pixmap.toImage();
+}
+
+int CRenderVerifier::compare( const QImage &reference, const QImage &result, int tolerance, int &maxDiff )
+{
+  maxDiff = 0;
+  if( result.size() != reference.size() )
+    return reference.width() * reference.height();
+
+  // premultiplied, so invisible colors of transparent pixels do not count
+  QImage a = reference.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+  QImage b = result.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+
+  int mismatches = 0;
+  for( int y = 0; y < a.height(); y++ )
+  {
+    const QRgb *la = reinterpret_cast<const QRgb*>( a.scanLine( y ) );
+    const QRgb *lb = reinterpret_cast<const QRgb*>( b.scanLine( y ) );
+
+    for( int x = 0; x < a.width(); x++ )
+    {
+      int diff = qMax( qMax( qAbs( qRed( la[x] ) - qRed( lb[x] ) ), qAbs( qGreen( la[x] ) - qGreen( lb[x] ) ) ),
+                       qMax( qAbs( qBlue( la[x] ) - qBlue( lb[x] ) ), qAbs( qAlpha( la[x] ) - qAlpha( lb[x] ) ) ) );
+      maxDiff = qMax( maxDiff, diff );
+      if( diff > tolerance )
+        mismatches++;
+    }
+  }
+
+  return mismatches;
+}
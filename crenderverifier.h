@@ -0,0 +1,127 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CRENDERVERIFIER_H
+#define CRENDERVERIFIER_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QTextStream>
+
+#include "ctimecodesettings.h"
+
+//! per channel difference accepted by default (rounding of premultiplied blending)
+#define VERIFY_TOLERANCE 2
+
+//! checks every fast overlay path against the plain QPainter reference
+/*!
+ * Synthetic frames are stamped with a range of fonts, colors, positions
+ * (including partly outside the frame), framerates and resolutions. The
+ * reference is the original QPainter on QPixmap code of processImages(),
+ * kept here apart from the code under test. Glyph cache plus pixel kernels
+ * (paint()), the whole frame pipeline including the png encoder
+ * (processFrame()) and the streaming path (CStripRenderer, for every kind
+ * of png it reads) must match it within a small per channel tolerance.
+ *
+ * The reference output is recorded once as golden images (record(),
+ * "timecode4 --record=<dir>", tests/render/golden for the tests), checks
+ * compare against those and only paint the reference where none exists.
+ *
+ * Used by the render tests (tests/render) and by "timecode4 --verify",
+ * which runs the same checks on a render node. Both need a gui
+ * QApplication, so text is rendered like in a regular run (on X11 with a
+ * display, e.g. from xvfb-run on headless nodes). While a verifier exists,
+ * glyph caches are kept in its temporary directory, not the user's cache.
+ */
+class CRenderVerifier
+{
+public:
+  //! a way of stamping a frame
+  enum Path
+  {
+    PaintRGB32,          //!< paint() on an RGB32 frame
+    PaintARGB32,         //!< paint() on an ARGB32 frame
+    PaintPremultiplied,  //!< paint() on an ARGB32_Premultiplied frame
+    FrameIndexed8,       //!< processFrame() on an indexed frame, through the encoder
+    StripRGB,            //!< CStripRenderer on an 8 bit RGB png
+    StripRGBA,           //!< CStripRenderer on an 8 bit RGBA png
+    StripRGB16,          //!< CStripRenderer on a 16 bit RGB png
+    StripRGBA16,         //!< CStripRenderer on a 16 bit RGBA png
+    StripGray,           //!< CStripRenderer on an 8 bit gray png
+    StripGrayAlpha,      //!< CStripRenderer on an 8 bit gray png with alpha
+    StripPalette,        //!< CStripRenderer on a palette png
+    StripPaletteAlpha,   //!< CStripRenderer on a palette png with transparency
+    PathCount
+  };
+
+  //! one combination of settings and frame properties
+  struct Case
+  {
+    CTimecodeSettings settings;
+    unsigned int seqNo;
+    int dotsPerMeter;
+  };
+
+  //! goldenDir holds the recorded reference images (empty = always paint the reference)
+  CRenderVerifier( int tolerance = VERIFY_TOLERANCE, const QString &goldenDir = QString() );
+  ~CRenderVerifier();
+
+  //! the combinations to check
+  static QList<Case> cases();
+  //! short description of a case
+  static QString caseName( const Case &c );
+  //! short name of a path
+  static QString pathName( Path path );
+  //! whether path can be checked in this build (streaming needs libpng)
+  static bool isAvailable( Path path );
+
+  //! stamp a frame through path and compare it, message tells the result
+  bool check( const Case &c, Path path, QString &message );
+  //! run all checks, print a report to out and return whether all passed
+  bool run( QTextStream &out );
+  //! write the reference of every case and input to dir as golden images
+  bool record( const QString &dir, QTextStream &out );
+
+private:
+  //! a frame with structure and varying alpha for the blending to work on
+  static QImage frame( QImage::Format format, int dotsPerMeter );
+  //! the frame path stamps, file is written for the streaming paths (null on failure)
+  static QImage input( const Case &c, Path path, const QString &file );
+  //! file name of the golden image for the input of path
+  static QString goldenName( const Case &c, Path path );
+  //! the reference: input painted like processImages() did, on a QPixmap
+  static QImage reference( const QImage &input, const Case &c );
+  //! compare two frames, returns the number of pixels off by more than tolerance
+  static int compare( const QImage &reference, const QImage &result, int tolerance, int &maxDiff );
+
+  //! per channel difference still accepted
+  int m_tolerance;
+  //! directory holding the golden images
+  QString m_goldenDir;
+  //! directory for the temporary frames of the file based paths
+  QString m_tempDir;
+
+  Q_DISABLE_COPY( CRenderVerifier )
+};
+
+#endif // CRENDERVERIFIER_H
@@ -0,0 +1,353 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QFile>
+#include <QImage>
+#include <QImageReader>
+#include <QRect>
+#include <QtGlobal>
+
+#include "cstriprenderer.h"
+#include "ctimecoderenderer.h"
+#include "cpixelkernels.h"
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+// limits in use, see setStreamThreshold()
+static qint64 s_streamPixels = STREAM_PIXELS;
+static int s_streamWidth = STREAM_WIDTH;
+
+#ifdef HAVE_LIBPNG
+
+//! state of one decoder -> encoder pass (plain data, survives longjmp)
+struct CStripStream
+{
+  FILE        *in;
+  FILE        *out;
+  png_structp  read;
+  png_infop    readInfo;
+  png_structp  write;
+  png_infop    writeInfo;
+  png_bytep    row;
+  png_uint_32  width, height;
+  png_uint_32  dpmX, dpmY;
+  int          depth;
+  int          channels;
+  int          interlace;
+  bool         alpha;
+};
+
+// open the input, read its header and set up the decoder transformations
+static bool openInput( CStripStream *s, const char *path )
+{
+  s->in = fopen( path, "rb" );
+  if( s->in == NULL )
+    return false;
+
+  s->read = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  if( s->read == NULL )
+    return false;
+  s->readInfo = png_create_info_struct( s->read );
+  if( s->readInfo == NULL )
+    return false;
+
+  if( setjmp( png_jmpbuf( s->read ) ) )
+    return false;
+
+  png_init_io( s->read, s->in );
+  png_read_info( s->read, s->readInfo );
+
+  int colorType;
+  png_get_IHDR( s->read, s->readInfo, &s->width, &s->height, &s->depth, &colorType,
+                &s->interlace, NULL, NULL );
+
+  // keep the resolution, like QImage::save() does
+  png_uint_32 resX, resY;
+  int unit;
+  if( png_get_pHYs( s->read, s->readInfo, &resX, &resY, &unit ) && unit == PNG_RESOLUTION_METER )
+  {
+    s->dpmX = resX;
+    s->dpmY = resY;
+  }
+
+  // everything becomes 8 or 16 bit RGB(A)
+  s->alpha = (colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid( s->read, s->readInfo, PNG_INFO_tRNS );
+  if( colorType == PNG_COLOR_TYPE_PALETTE )
+    png_set_palette_to_rgb( s->read );
+  if( colorType == PNG_COLOR_TYPE_GRAY && s->depth < 8 )
+    png_set_expand_gray_1_2_4_to_8( s->read );
+  if( png_get_valid( s->read, s->readInfo, PNG_INFO_tRNS ) )
+    png_set_tRNS_to_alpha( s->read );
+  if( colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA )
+    png_set_gray_to_rgb( s->read );
+  if( s->depth < 8 )
+    s->depth = 8;
+
+  if( s->depth == 8 )
+  {
+    // 8 bit rows are laid out like QImage's 32 bit formats
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    png_set_bgr( s->read );
+    if( !s->alpha )
+      png_set_filler( s->read, 0xff, PNG_FILLER_AFTER );
+#else
+    if( s->alpha )
+      png_set_swap_alpha( s->read );
+    else
+      png_set_filler( s->read, 0xff, PNG_FILLER_BEFORE );
+#endif
+  }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  else
+    png_set_swap( s->read );
+#endif
+
+  png_read_update_info( s->read, s->readInfo );
+  s->channels = png_get_channels( s->read, s->readInfo );
+
+  return true;
+}
+
+// copy all rows from input to output, blending the overlay into its rows
+static bool streamRows( CStripStream *s, const char *path, const unsigned int *overlay,
+                        int stride, int ox, int oy, int ow, int oh, const CCancelToken *token )
+{
+  s->out = fopen( path, "wb" );
+  if( s->out == NULL )
+    return false;
+
+  s->write = png_create_write_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  if( s->write == NULL )
+    return false;
+  s->writeInfo = png_create_info_struct( s->write );
+  if( s->writeInfo == NULL )
+    return false;
+
+  s->row = static_cast<png_bytep>( malloc( png_get_rowbytes( s->read, s->readInfo ) ) );
+  if( s->row == NULL )
+    return false;
+
+  // errors of either side end up here
+  if( setjmp( png_jmpbuf( s->read ) ) )
+    return false;
+  if( setjmp( png_jmpbuf( s->write ) ) )
+    return false;
+
+  png_init_io( s->write, s->out );
+  png_set_IHDR( s->write, s->writeInfo, s->width, s->height, s->depth,
+                s->alpha ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT );
+  if( s->dpmX > 0 && s->dpmY > 0 )
+    png_set_pHYs( s->write, s->writeInfo, s->dpmX, s->dpmY, PNG_RESOLUTION_METER );
+  // same as QImage::save() with quality 100
+  png_set_compression_level( s->write, 0 );
+  png_write_info( s->write, s->writeInfo );
+
+  // undo the decoder's layout on the way out
+  if( s->depth == 8 )
+  {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    png_set_bgr( s->write );
+    if( !s->alpha )
+      png_set_filler( s->write, 0, PNG_FILLER_AFTER );
+#else
+    if( s->alpha )
+      png_set_swap_alpha( s->write );
+    else
+      png_set_filler( s->write, 0, PNG_FILLER_BEFORE );
+#endif
+  }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  else
+    png_set_swap( s->write );
+#endif
+
+  for( png_uint_32 y = 0; y < s->height; y++ )
+  {
+    // a single row is cheap, so cancellation is noticed almost immediately
+    if( token != NULL && token->isCancelled() )
+      return false;
+
+    png_read_row( s->read, s->row, NULL );
+
+    // blend the overlay into the rows it covers
+    if( overlay != NULL && (int)y >= oy && (int)y < oy + oh )
+    {
+      const unsigned int *src = overlay + (y - oy) * stride;
+
+      if( s->depth == 16 )
+        CPixelKernels::blendRGB16( reinterpret_cast<unsigned short*>( s->row ) + ox * s->channels,
+                                   src, ow, s->channels );
+      else if( s->alpha )
+        CPixelKernels::blendARGB32( reinterpret_cast<unsigned int*>( s->row ) + ox, src, ow );
+      else
+        CPixelKernels::blendPremultiplied( reinterpret_cast<unsigned int*>( s->row ) + ox, src, ow );
+    }
+
+    png_write_row( s->write, s->row );
+  }
+
+  png_read_end( s->read, NULL );
+  png_write_end( s->write, NULL );
+
+  return fflush( s->out ) == 0;
+}
+
+// release everything the stream holds
+static bool closeStream( CStripStream *s )
+{
+  bool ok = true;
+
+  if( s->read != NULL )
+    png_destroy_read_struct( &s->read, s->readInfo ? &s->readInfo : NULL, NULL );
+  if( s->write != NULL )
+    png_destroy_write_struct( &s->write, s->writeInfo ? &s->writeInfo : NULL );
+  free( s->row );
+
+  if( s->in != NULL )
+    fclose( s->in );
+  if( s->out != NULL )
+    ok = fclose( s->out ) == 0;
+
+  memset( s, 0, sizeof( *s ) );
+  return ok;
+}
+
+// bit depth and interlace method from the IHDR chunk, which every png starts with
+static bool readHeader( const QString &input, int &depth, bool &interlaced )
+{
+  QFile file( input );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  // signature (8), chunk length (4), "IHDR" (4), width (4), height (4), depth, color, compression, filter, interlace
+  QByteArray header = file.read( 29 );
+  if( header.size() < 29 || !header.startsWith( QByteArray( "\x89PNG\r\n\x1a\n", 8 ) )
+      || header.mid( 12, 4 ) != "IHDR" )
+    return false;
+
+  depth = uchar( header.at( 24 ) );
+  interlaced = header.at( 28 ) != 0;
+  return true;
+}
+
+#endif // HAVE_LIBPNG
+
+bool CStripRenderer::canStream( const QString &input )
+{
+#ifdef HAVE_LIBPNG
+  QImageReader reader( input );
+  if( reader.format() != "png" )
+    return false;
+
+  QSize size = reader.size();
+  if( !size.isValid() )
+    return false;
+
+  // Qt would cut 16 bit frames down to 8 bit, stream them all so the output
+  // depth does not depend on the frame size (interlaced ones can not be streamed)
+  int depth;
+  bool interlaced;
+  if( readHeader( input, depth, interlaced ) && depth == 16 && !interlaced )
+    return true;
+
+  // otherwise only worth it for frames which hardly fit into memory, or are very wide (panoramas)
+  return (s_streamPixels > 0 && qint64( size.width() ) * size.height() >= s_streamPixels)
+         || (s_streamWidth > 0 && size.width() >= s_streamWidth);
+#else
+  Q_UNUSED( input );
+  return false;
+#endif
+}
+
+void CStripRenderer::setStreamThreshold( qint64 pixels, int width )
+{
+  s_streamPixels = pixels;
+  s_streamWidth  = width;
+}
+
+CStripRenderer::Result CStripRenderer::processFrame( const QString &input, const QString &output,
+                                                     const CTimecodeSettings &settings, unsigned int seqNo,
+                                                     const CCancelToken *token )
+{
+#ifdef HAVE_LIBPNG
+  CStripStream s;
+  memset( &s, 0, sizeof( s ) );
+
+  QByteArray inName  = QFile::encodeName( input );
+  QString partial     = CTimecodeRenderer::partialName( output );
+  QByteArray outName = QFile::encodeName( partial );
+
+  if( !openInput( &s, inName.constData() ) )
+  {
+    closeStream( &s );
+    return Failed;
+  }
+
+  // interlaced rows arrive in several passes, they can not be streamed
+  if( s.interlace != PNG_INTERLACE_NONE )
+  {
+    closeStream( &s );
+    return Unsupported;
+  }
+
+  QRect rect = CTimecodeRenderer::overlayRect( QRect( 0, 0, s.width, s.height ), settings, seqNo );
+  QImage overlay;
+  if( !rect.isEmpty() )
+  {
+    overlay = CTimecodeRenderer::renderOverlay( rect, settings, seqNo, token );
+    // cancelled while the gui thread painted the text
+    if( overlay.isNull() )
+    {
+      closeStream( &s );
+      QFile::remove( partial );
+      return Failed;
+    }
+  }
+
+  bool ok = streamRows( &s, outName.constData(),
+                        overlay.isNull() ? NULL : reinterpret_cast<const unsigned int*>( overlay.bits() ),
+                        overlay.bytesPerLine() / 4, rect.x(), rect.y(), rect.width(), rect.height(), token );
+  ok = closeStream( &s ) && ok;
+
+  // never leave a truncated frame behind
+  if( !ok )
+  {
+    QFile::remove( partial );
+    return Failed;
+  }
+
+  return CTimecodeRenderer::commitFile( partial, output ) ? Done : Failed;
+#else
+  Q_UNUSED( input );
+  Q_UNUSED( output );
+  Q_UNUSED( settings );
+  Q_UNUSED( seqNo );
+  Q_UNUSED( token );
+  return Unsupported;
+#endif
+}
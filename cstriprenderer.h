@@ -0,0 +1,69 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CSTRIPRENDERER_H
+#define CSTRIPRENDERER_H
+
+#include <QString>
+
+#include "ctimecodesettings.h"
+#include "ccanceltoken.h"
+
+//! frames with at least this many pixels are streamed by default
+#define STREAM_PIXELS (64 * 1024 * 1024)
+//! frames at least this wide are streamed by default (panoramas)
+#define STREAM_WIDTH  16384
+
+//! stamps very large png frames scanline by scanline
+/*!
+ * Rows are read from the decoder and handed to the encoder one at a time,
+ * only the rows covered by the badge are blended on their way through.
+ * Peak memory is one row plus the badge, regardless of the frame size.
+ * Needs libpng (HAVE_LIBPNG), otherwise no frame is ever streamed.
+ *
+ * 16 bit frames keep their depth when streamed, while QImage would reduce
+ * them to 8 bit. They are therefore streamed regardless of their size, so
+ * the output depth of a sequence does not depend on the thresholds. Only
+ * interlaced 16 bit frames, which can not be streamed, come out 8 bit.
+ */
+class CStripRenderer
+{
+public:
+  //! result of streaming a frame
+  enum Result
+  {
+    Done,        //!< frame has been stamped and written
+    Failed,      //!< frame could not be read or written
+    Unsupported  //!< frame can not be streamed (e.g. interlaced), use CTimecodeRenderer
+  };
+
+  //! whether input is a png large enough to be streamed, or any non-interlaced 16 bit png
+  static bool canStream( const QString &input );
+  //! stream frames with at least pixels pixels or at least width columns (0 = no limit of that kind)
+  static void setStreamThreshold( qint64 pixels, int width );
+  //! stream input to output, blending in the badge
+  static Result processFrame( const QString &input, const QString &output,
+                              const CTimecodeSettings &settings, unsigned int seqNo,
+                              const CCancelToken *token = 0 );
+};
+
+#endif // CSTRIPRENDERER_H
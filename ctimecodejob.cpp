@@ -0,0 +1,119 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QDir>
+#include <QImageReader>
+#include <QSettings>
+#include <QStringList>
+#include <QMutexLocker>
+
+#include "ctimecodejob.h"
+#include "ctimecoderenderer.h"
+#include "cglyphcache.h"
+
+CTimecodeJob::CTimecodeJob( const QString &inputDir, const QString &outputDir, const CTimecodeSettings &settings )
+  : m_inputDir( inputDir ), m_outputDir( outputDir ), m_settings( settings ),
+  m_glyphs( CGlyphCache::get( settings ) ), m_cache( outputDir, settings.fingerprint() )
+{
+}
+
+bool CTimecodeJob::scan()
+{
+  QDir dir( m_inputDir );
+  dir.setFilter( QDir::Files );
+  dir.setSorting( QDir::Name );
+
+  m_frames = dir.entryInfoList();
+
+  // the sequence starts with the first readable image
+  while( !m_frames.isEmpty() && !QImageReader( m_frames.first().absoluteFilePath() ).canRead() )
+    m_frames.removeFirst();
+
+  return !m_frames.isEmpty();
+}
+
+bool CTimecodeJob::processFrame( int index, const CCancelToken *token )
+{
+  return processFrame( m_frames.at( index ), index + 1, token );
+}
+
+bool CTimecodeJob::processFrame( const QFileInfo &input, unsigned int seqNo, const CCancelToken *token )
+{
+  QString output = m_outputDir + "/" + input.baseName() + ".png";
+
+  {
+    QMutexLocker lock( &m_cacheMutex );
+    if( m_cache.isUpToDate( input, seqNo, output ) )
+      return true;
+  }
+
+  if( !CTimecodeRenderer::processFrame( input.absoluteFilePath(), output, m_settings, seqNo, token ) )
+    return false;
+
+  QMutexLocker lock( &m_cacheMutex );
+  m_cache.update( input, seqNo, output );
+  return true;
+}
+
+void CTimecodeJob::saveCache()
+{
+  QMutexLocker lock( &m_cacheMutex );
+  m_cache.save();
+}
+
+QList<CTimecodeJob*> CTimecodeJob::loadJobFile( const QString &path, const CTimecodeSettings &defaults )
+{
+  QList<CTimecodeJob*> jobs;
+  QSettings file( path, QSettings::IniFormat );
+
+  // every group describes one job
+  foreach( const QString &group, file.childGroups() )
+  {
+    file.beginGroup( group );
+
+    QString input  = file.value( "input" ).toString();
+    QString output = file.value( "output" ).toString();
+
+    CTimecodeSettings settings = defaults;
+    settings.framerate = file.value( "fps", defaults.framerate ).toDouble();
+    settings.posX      = file.value( "pos_x", defaults.posX ).toInt();
+    settings.posY      = file.value( "pos_y", defaults.posY ).toInt();
+
+    if( file.contains( "font" ) )
+      settings.font.fromString( file.value( "font" ).toString() );
+    if( file.contains( "font_color" ) )
+      settings.textColor.setNamedColor( file.value( "font_color" ).toString() );
+    if( file.contains( "frame_color" ) )
+      settings.frameColor.setNamedColor( file.value( "frame_color" ).toString() );
+
+    file.endGroup();
+
+    // skip incomplete jobs
+    if( input.isEmpty() || output.isEmpty() || settings.framerate <= 0.0 )
+      continue;
+
+    settings.updateBadgeSize();
+    jobs.append( new CTimecodeJob( input, output, settings ) );
+  }
+
+  return jobs;
+}
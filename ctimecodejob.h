@@ -0,0 +1,83 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CTIMECODEJOB_H
+#define CTIMECODEJOB_H
+
+#include <QString>
+#include <QList>
+#include <QFileInfoList>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include "ctimecodesettings.h"
+#include "cjobcache.h"
+#include "ccanceltoken.h"
+
+class CGlyphCache;
+
+//! one input directory -> output directory pair with its own settings
+class CTimecodeJob
+{
+public:
+  //! create in the gui thread, the glyphs are rasterized here
+  CTimecodeJob( const QString &inputDir, const QString &outputDir, const CTimecodeSettings &settings );
+
+  //! collect the frames of the input directory (call before processing)
+  bool scan();
+  //! stamp the frame at index in the sequence (thread safe)
+  bool processFrame( int index, const CCancelToken *token = 0 );
+  //! stamp a single frame with the given sequence number (thread safe)
+  bool processFrame( const QFileInfo &input, unsigned int seqNo, const CCancelToken *token = 0 );
+  //! write the cache of this job to disk (thread safe)
+  void saveCache();
+
+  //! the input directory
+  const QString &inputDir() const { return m_inputDir; }
+  //! the output directory
+  const QString &outputDir() const { return m_outputDir; }
+  //! the overlay settings of this job
+  const CTimecodeSettings &settings() const { return m_settings; }
+  //! number of frames in this job
+  int frameCount() const { return m_frames.size(); }
+
+  //! read jobs from an ini style job file, missing values are taken from defaults
+  static QList<CTimecodeJob*> loadJobFile( const QString &path, const CTimecodeSettings &defaults );
+
+private:
+  //! the input directory
+  QString m_inputDir;
+  //! the output directory
+  QString m_outputDir;
+  //! the overlay settings
+  CTimecodeSettings m_settings;
+  //! all frames, starting with the first readable image
+  QFileInfoList m_frames;
+  //! glyphs of the job, held for its whole run so workers never rasterize
+  QSharedPointer<const CGlyphCache> m_glyphs;
+  //! cache of up to date frames in the output directory
+  CJobCache m_cache;
+  //! the cache is shared by all workers
+  QMutex m_cacheMutex;
+};
+
+#endif // CTIMECODEJOB_H
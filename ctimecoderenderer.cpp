@@ -0,0 +1,403 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QPainter>
+#include <QBrush>
+#include <QVector>
+#include <QFile>
+#include <QImageWriter>
+#include <QCoreApplication>
+#include <QThread>
+#include <QEvent>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QFontDatabase>
+
+#include <sstream>
+#include <cstdio>
+
+#include "ctimecoderenderer.h"
+#include "cpixelkernels.h"
+#include "cstriprenderer.h"
+#include "cglyphcache.h"
+
+// interval in milliseconds a worker waiting for the gui thread checks its token
+#define TEXT_WAIT_INTERVAL 50
+
+//! timecode text to be painted by the gui thread for a worker
+struct CTextRequest
+{
+  QImage overlay;
+  QRect rect;
+  CTimecodeSettings settings;
+  unsigned int seqNo;
+  bool done;
+};
+
+// guards CTextRequest::done, signals its change
+static QMutex s_textMutex;
+static QWaitCondition s_textDone;
+
+//! carries a text request to the gui thread
+class CTextEvent : public QEvent
+{
+public:
+  CTextEvent( const QSharedPointer<CTextRequest> &request )
+    : QEvent( QEvent::User ), request( request ) {}
+
+  QSharedPointer<CTextRequest> request;
+};
+
+//! lives in the gui thread, paints the text of the requests posted to it
+class CTextPainter : public QObject
+{
+protected:
+  bool event( QEvent *e )
+  {
+    if( e->type() != QEvent::User )
+      return QObject::event( e );
+
+    // the worker may have given up (cancelled), the request lives on until here
+    QSharedPointer<CTextRequest> request = static_cast<CTextEvent*>( e )->request;
+    CTimecodeRenderer::paintText( request->overlay, request->rect, request->settings, request->seqNo );
+
+    QMutexLocker lock( &s_textMutex );
+    request->done = true;
+    s_textDone.wakeAll();
+    return true;
+  }
+};
+
+// paint the text where fonts may be rendered, false if the token got cancelled while waiting
+static bool paintTextSafely( QImage &overlay, const QRect &rect, const CTimecodeSettings &settings,
+                             unsigned int seqNo, const CCancelToken *token )
+{
+  QCoreApplication *app = QCoreApplication::instance();
+  if( QFontDatabase::supportsThreadedFontRendering() || app == NULL || QThread::currentThread() == app->thread() )
+  {
+    CTimecodeRenderer::paintText( overlay, rect, settings, seqNo );
+    return true;
+  }
+
+  // created by the first worker in need and handed to the gui thread for good
+  static QMutex painterMutex;
+  static CTextPainter *painter = NULL;
+  {
+    QMutexLocker lock( &painterMutex );
+    if( painter == NULL )
+    {
+      painter = new CTextPainter;
+      painter->moveToThread( app->thread() );
+    }
+  }
+
+  QSharedPointer<CTextRequest> request( new CTextRequest );
+  request->overlay  = overlay;
+  request->rect     = rect;
+  request->settings = settings;
+  request->seqNo    = seqNo;
+  request->done     = false;
+  QCoreApplication::postEvent( painter, new CTextEvent( request ) );
+
+  // the gui thread cancels before it waits for workers, so this never deadlocks
+  QMutexLocker lock( &s_textMutex );
+  while( !request->done )
+  {
+    if( token != NULL && token->isCancelled() )
+      return false;
+    s_textDone.wait( &s_textMutex, TEXT_WAIT_INTERVAL );
+  }
+
+  overlay = request->overlay;
+  return true;
+}
+
+//! file that fails to write once the token is cancelled, aborts the encoder
+class CCancellableFile : public QFile
+{
+public:
+  CCancellableFile( const QString &name, const CCancelToken *token )
+    : QFile( name ), m_token( token ) {}
+
+protected:
+  qint64 writeData( const char *data, qint64 len )
+  {
+    if( m_token != NULL && m_token->isCancelled() )
+      return -1;
+    return QFile::writeData( data, len );
+  }
+
+private:
+  const CCancelToken *m_token;
+};
+
+QString CTimecodeRenderer::timecode( unsigned int seqNo, double framerate )
+{
+  unsigned int hour, min, secs;
+
+  // get number of overall seconds:
+  secs = static_cast<unsigned int>( seqNo / framerate );
+  // get remaining frames in second
+  unsigned int frame = static_cast<unsigned int>( seqNo - (secs*framerate ) );
+  // get overall hours and subtract seconds in the hours from the secs
+  hour = static_cast<unsigned int>( secs / 3600 );
+  secs -= hour * 3600;
+  // get overall minutes and subtract them from secs
+  min = static_cast<unsigned int>( secs / 60 );
+  secs -= min * 60;
+
+  // create a string for the timecode
+  std::stringstream tcstring;
+  tcstring.fill( '0' );
+  tcstring.width( 2 );
+  tcstring << hour << ":";
+  tcstring.width( 2 );
+  tcstring << min << ":";
+  tcstring.width( 2 );
+  tcstring << secs << ".";
+  tcstring.width( 2 );
+  tcstring << frame;
+
+  return QString::fromStdString( tcstring.str() );
+}
+
+void CTimecodeRenderer::drawBadge( QPainter &painter, const CTimecodeSettings &settings )
+{
+  QFont font = settings.font;
+  unsigned int fontSize = (font.pixelSize() == -1 ? font.pointSize() : font.pixelSize());
+
+  qreal radius = fontSize/5.0;
+
+  // get brush from painter
+  QBrush brush = painter.brush();
+  // get color from frame color
+  QColor color = settings.frameColor;
+  // set alpha value (to 40%)
+  color.setAlpha( RECTALPHA );
+  // set brushes color
+  brush.setColor( color );
+  // set to solid
+  brush.setStyle( Qt::SolidPattern );
+  // reapply brush
+  painter.setBrush( brush );
+  // reset pen
+  painter.setPen( Qt::NoPen );
+
+  // draw rounded rectangle
+  painter.drawRoundedRect( settings.posX, settings.posY, settings.badgeWidth, settings.badgeHeight, radius, radius );
+}
+
+void CTimecodeRenderer::drawTimecode( QPainter &painter, const CTimecodeSettings &settings, unsigned int seqNo )
+{
+  QPoint origin = textOrigin( settings );
+
+  // set font and text color
+  painter.setFont( settings.textFont() );
+  painter.setPen( settings.textColor );
+
+  painter.drawText( origin, timecode( seqNo, settings.framerate ) );
+}
+
+QPoint CTimecodeRenderer::textOrigin( const CTimecodeSettings &settings )
+{
+  QFont font = settings.font;
+  unsigned int fontSize = (font.pixelSize() == -1 ? font.pointSize() : font.pixelSize());
+
+  return QPoint( settings.posX + fontSize/4, settings.posY + fontSize + fontSize/16 );
+}
+
+void CTimecodeRenderer::paintText( QImage &overlay, const QRect &rect, const CTimecodeSettings &settings,
+                                   unsigned int seqNo )
+{
+  QPainter painter( &overlay );
+  painter.translate( -rect.topLeft() );
+  drawTimecode( painter, settings, seqNo );
+}
+
+QRect CTimecodeRenderer::overlayRect( const QRect &bounds, const CTimecodeSettings &settings, unsigned int seqNo )
+{
+  QSharedPointer<const CGlyphCache> glyphs = CGlyphCache::get( settings );
+
+  QRect rect = glyphs->extent( QPoint( settings.posX, settings.posY ), timecode( seqNo, settings.framerate ) );
+  return rect.intersected( bounds );
+}
+
+QImage CTimecodeRenderer::renderOverlay( const QRect &rect, const CTimecodeSettings &settings, unsigned int seqNo,
+                                         const CCancelToken *token )
+{
+  QImage overlay( rect.size(), QImage::Format_ARGB32_Premultiplied );
+  overlay.fill( 0 );
+
+  // put together from pre-rasterized glyphs, the font is not needed here
+  QSharedPointer<const CGlyphCache> glyphs = CGlyphCache::get( settings );
+  QString text = timecode( seqNo, settings.framerate );
+  glyphs->compose( overlay, rect, QPoint( settings.posX, settings.posY ), text );
+
+  // glyphs which do not match drawText() on this system are not used
+  if( !glyphs->exact() && !paintTextSafely( overlay, rect, settings, seqNo, token ) )
+    return QImage();
+
+  return overlay;
+}
+
+void CTimecodeRenderer::blendOverlay( QImage &image, const QImage &overlay, const QPoint &pos )
+{
+  for( int row = 0; row < overlay.height(); row++ )
+  {
+    unsigned int *dst = reinterpret_cast<unsigned int*>( image.scanLine( pos.y() + row ) ) + pos.x();
+    const unsigned int *src = reinterpret_cast<const unsigned int*>( overlay.scanLine( row ) );
+
+    if( image.format() == QImage::Format_ARGB32 )
+      CPixelKernels::blendARGB32( dst, src, overlay.width() );
+    else
+      CPixelKernels::blendPremultiplied( dst, src, overlay.width() );
+  }
+}
+
+void CTimecodeRenderer::paint( QImage &image, const CTimecodeSettings &settings, unsigned int seqNo,
+                               const CCancelToken *token )
+{
+  // formats without a blend kernel become 32 bit, a QPainter would render the font right here
+  if( image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32
+      && image.format() != QImage::Format_ARGB32_Premultiplied )
+    image = image.convertToFormat( image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32 );
+
+  // only the area under the badge is painted, the frame keeps its format
+  QRect rect = overlayRect( image.rect(), settings, seqNo );
+  if( rect.isEmpty() )
+    return;
+
+  QImage overlay = renderOverlay( rect, settings, seqNo, token );
+  if( !overlay.isNull() )
+    blendOverlay( image, overlay, rect.topLeft() );
+}
+
+QImage CTimecodeRenderer::convertIndexed( const QImage &image )
+{
+  QImage result( image.size(), image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32 );
+  result.setDotsPerMeterX( image.dotsPerMeterX() );
+  result.setDotsPerMeterY( image.dotsPerMeterY() );
+
+  // pad the color table, so broken files can not read beyond it
+  QVector<QRgb> colorTable = image.colorTable();
+  colorTable.resize( 256 );
+
+  for( int row = 0; row < image.height(); row++ )
+  {
+    CPixelKernels::convertIndexed8( reinterpret_cast<unsigned int*>( result.scanLine( row ) ),
+                                    image.scanLine( row ), colorTable.constData(), image.width() );
+  }
+
+  return result;
+}
+
+bool CTimecodeRenderer::processFrame( QImage &image, const QString &output,
+                                      const CTimecodeSettings &settings, unsigned int seqNo,
+                                      const CCancelToken *token )
+{
+  if( image.isNull() )
+    return false;
+
+  // indexed images (e.g. grayscale) have to become true color to carry the badge
+  if( image.format() == QImage::Format_Indexed8 )
+    image = convertIndexed( image );
+  else if( image.format() == QImage::Format_Mono || image.format() == QImage::Format_MonoLSB )
+    image = image.convertToFormat( image.hasAlphaChannel() ? QImage::Format_ARGB32
+                                                           : QImage::Format_RGB32 );
+
+  paint( image, settings, seqNo, token );
+
+  // stage boundary: painted
+  if( token != NULL && token->isCancelled() )
+    return false;
+
+  return saveFrame( image, output, token );
+}
+
+bool CTimecodeRenderer::processFrame( const QString &input, const QString &output,
+                                      const CTimecodeSettings &settings, unsigned int seqNo,
+                                      const CCancelToken *token )
+{
+  // very large frames are streamed instead of being loaded as a whole
+  if( CStripRenderer::canStream( input ) )
+  {
+    CStripRenderer::Result result = CStripRenderer::processFrame( input, output, settings, seqNo, token );
+    if( result != CStripRenderer::Unsupported )
+      return result == CStripRenderer::Done;
+  }
+
+  QImage image( input );
+
+  // stage boundary: decoded
+  if( token != NULL && token->isCancelled() )
+    return false;
+
+  return processFrame( image, output, settings, seqNo, token );
+}
+
+bool CTimecodeRenderer::saveFrame( const QImage &image, const QString &output, const CCancelToken *token )
+{
+  QString partial = partialName( output );
+
+  {
+    CCancellableFile file( partial, token );
+    if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+      return false;
+
+    QImageWriter writer( &file, "PNG" );
+    writer.setQuality( 100 );
+
+    if( !writer.write( image ) || !file.flush() )
+    {
+      file.close();
+      file.remove();
+      return false;
+    }
+  }
+
+  return commitFile( partial, output );
+}
+
+QString CTimecodeRenderer::partialName( const QString &output )
+{
+  return output + ".part";
+}
+
+bool CTimecodeRenderer::commitFile( const QString &partial, const QString &output )
+{
+  QByteArray from = QFile::encodeName( partial );
+  QByteArray to   = QFile::encodeName( output );
+
+  // rename() replaces the target atomically on posix systems
+  if( ::rename( from.constData(), to.constData() ) == 0 )
+    return true;
+
+  // others refuse to replace existing files
+  QFile::remove( output );
+  if( QFile::rename( partial, output ) )
+    return true;
+
+  QFile::remove( partial );
+  return false;
+}
@@ -0,0 +1,94 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CTIMECODERENDERER_H
+#define CTIMECODERENDERER_H
+
+#include <QString>
+#include <QImage>
+#include <QRect>
+#include <QPoint>
+
+#include "ctimecodesettings.h"
+#include "ccanceltoken.h"
+
+class QPainter;
+
+//! alpha of the rounded rectangle (40%)
+#define RECTALPHA 102
+
+//! stamps timecodes into frames, safe to use from worker threads
+/*!
+ * Only QImage is used here, since QPixmap must not be touched outside the
+ * gui thread. Frames are not painted on directly: the badge is composed
+ * from CGlyphCache into a small overlay which is blended into the frame by
+ * CPixelKernels. Where the glyphs do not match drawText() the text is
+ * painted with QPainter instead; if the platform can not render fonts
+ * outside the gui thread, a worker has the gui thread paint it and waits.
+ *
+ * Output is written to a partial file first and renamed once complete, so
+ * a cancelled or failed frame never leaves a truncated png behind.
+ */
+class CTimecodeRenderer
+{
+public:
+  //! timecode string for the given sequence number
+  static QString timecode( unsigned int seqNo, double framerate );
+  //! paint rounded rectangle and timecode into image (formats without a blend kernel become 32 bit)
+  static void paint( QImage &image, const CTimecodeSettings &settings, unsigned int seqNo,
+                     const CCancelToken *token = 0 );
+  //! area within bounds touched by rounded rectangle and timecode
+  static QRect overlayRect( const QRect &bounds, const CTimecodeSettings &settings, unsigned int seqNo );
+  //! compose rounded rectangle and timecode for rect into a premultiplied image (null if cancelled)
+  static QImage renderOverlay( const QRect &rect, const CTimecodeSettings &settings, unsigned int seqNo,
+                               const CCancelToken *token = 0 );
+  //! blend a premultiplied overlay into image at pos, keeping the image's format
+  static void blendOverlay( QImage &image, const QImage &overlay, const QPoint &pos );
+  //! stamp image in place and save it as png to output
+  static bool processFrame( QImage &image, const QString &output,
+                            const CTimecodeSettings &settings, unsigned int seqNo,
+                            const CCancelToken *token = 0 );
+  //! load input, stamp it and save it as png to output
+  static bool processFrame( const QString &input, const QString &output,
+                            const CTimecodeSettings &settings, unsigned int seqNo,
+                            const CCancelToken *token = 0 );
+  //! save image as png to output, output only appears if it has been written completely
+  static bool saveFrame( const QImage &image, const QString &output, const CCancelToken *token = 0 );
+  //! name of the file output is written to before it is complete
+  static QString partialName( const QString &output );
+  //! move a completely written partial file to output
+  static bool commitFile( const QString &partial, const QString &output );
+  //! draw the rounded rectangle with painter
+  static void drawBadge( QPainter &painter, const CTimecodeSettings &settings );
+  //! draw the timecode text with painter
+  static void drawTimecode( QPainter &painter, const CTimecodeSettings &settings, unsigned int seqNo );
+  //! pen position of the timecode text on the baseline
+  static QPoint textOrigin( const CTimecodeSettings &settings );
+  //! paint the timecode text into an overlay covering rect of the frame
+  static void paintText( QImage &overlay, const QRect &rect, const CTimecodeSettings &settings, unsigned int seqNo );
+
+private:
+  //! expand an indexed image to 32 bit
+  static QImage convertIndexed( const QImage &image );
+};
+
+#endif // CTIMECODERENDERER_H
@@ -0,0 +1,67 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QDataStream>
+#include <QCryptographicHash>
+#include "ctimecodesettings.h"
+#include "cglyphcache.h"
+
+// bump whenever the painting code changes its output
+#define RENDER_VERSION 5
+
+CTimecodeSettings::CTimecodeSettings()
+  : framerate( 25.0 ), dpi( 96 ), posX( 0 ), posY( 0 ), badgeWidth( 0 ), badgeHeight( 0 )
+{
+}
+
+QByteArray CTimecodeSettings::fingerprint() const
+{
+  QByteArray data;
+  QDataStream stream( &data, QIODevice::WriteOnly );
+
+  // serialize everything that ends up in the output image
+  stream << (qint32)RENDER_VERSION << framerate << font.toString() << (qint32)dpi
+         << (quint32)textColor.rgba() << (quint32)frameColor.rgba()
+         << (qint32)posX << (qint32)posY
+         << (quint32)badgeWidth << (quint32)badgeHeight;
+
+  return QCryptographicHash::hash( data, QCryptographicHash::Md5 );
+}
+
+void CTimecodeSettings::updateBadgeSize()
+{
+  // measured once per font when the glyphs are rasterized
+  QSize size = CGlyphCache::get( *this )->badgeSize();
+  badgeWidth  = size.width();
+  badgeHeight = size.height();
+}
+
+QFont CTimecodeSettings::textFont() const
+{
+  if( font.pixelSize() != -1 )
+    return font;
+
+  // the painter would scale point sizes by the frame's resolution (300 dpi scans!)
+  QFont pixelFont = font;
+  pixelFont.setPixelSize( qMax( 1, qRound( font.pointSizeF() * dpi / 72.0 ) ) );
+  return pixelFont;
+}
@@ -0,0 +1,59 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CTIMECODESETTINGS_H
+#define CTIMECODESETTINGS_H
+
+#include <QFont>
+#include <QColor>
+#include <QByteArray>
+
+//! all parameters that influence the stamped output of a frame
+class CTimecodeSettings
+{
+public:
+  CTimecodeSettings();
+
+  //! hash over all overlay parameters (used as cache key)
+  QByteArray fingerprint() const;
+  //! take the size of the rounded rectangle from the glyph cache (measured on the font once)
+  void updateBadgeSize();
+  //! font for the text, point sizes converted to pixels at dpi
+  QFont textFont() const;
+
+  //! the framerate used to compute the timecode
+  double framerate;
+  //! font of the timecode text
+  QFont font;
+  //! resolution point sizes refer to (that of the preview), frames do not change the text size
+  int dpi;
+  //! color of the timecode text
+  QColor textColor;
+  //! color of the rounded rectangle (alpha is applied when painting)
+  QColor frameColor;
+  //! position of the rounded rectangle
+  int posX, posY;
+  //! size of the rounded rectangle
+  unsigned int badgeWidth, badgeHeight;
+};
+
+#endif // CTIMECODESETTINGS_H
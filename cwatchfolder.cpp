@@ -0,0 +1,266 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QStringList>
+#include <QRunnable>
+
+#include "cwatchfolder.h"
+#include "ctimecodejob.h"
+
+// interval between two size checks in milliseconds
+#define POLL_INTERVAL 250
+// number of polls a frame's size must not change to count as complete
+#define STABLE_POLLS  2
+// write the job cache every this many frames
+#define CACHE_SAVE_INTERVAL 100
+// attempts to stamp a frame that keeps failing before waiting for it to change
+#define STAMP_RETRIES 3
+
+//! stamps one frame on the watcher's thread pool
+class CWatchTask : public QRunnable
+{
+public:
+  CWatchTask( CWatchFolder *watcher, CTimecodeJob *job, const QFileInfo &input, int seqNo,
+              const CCancelToken *token )
+    : m_watcher( watcher ), m_job( job ), m_input( input ), m_seqNo( seqNo ), m_token( token ) {}
+
+  void run()
+  {
+    // before the first frame of this thread, so its buffers are allocated on its node
+    m_watcher->bindCurrentThread();
+
+    bool ok = m_job->processFrame( m_input, m_seqNo, m_token );
+
+    // report back to the gui thread
+    QMetaObject::invokeMethod( m_watcher, "frameDone", Qt::QueuedConnection,
+                               Q_ARG( QString, m_input.fileName() ), Q_ARG( int, m_seqNo ), Q_ARG( bool, ok ) );
+  }
+
+private:
+  CWatchFolder *m_watcher;
+  CTimecodeJob *m_job;
+  QFileInfo m_input;
+  int m_seqNo;
+  const CCancelToken *m_token;
+};
+
+CWatchFolder::CWatchFolder( const QString &inputDir, const QString &outputDir, const CTimecodeSettings &settings,
+                            const CWorkerPlacement &placement, QObject *parent )
+  : QObject( parent ), m_inputDir( inputDir ),
+  m_job( new CTimecodeJob( inputDir, outputDir, settings ) ), m_done( 0 ),
+  m_placement( placement ), m_nextSlot( 0 )
+{
+  m_timer.setInterval( POLL_INTERVAL );
+
+  // bound threads are kept, so worker numbers are not handed out over and over
+  if( m_placement.policy() != CWorkerPlacement::Unpinned )
+  {
+    m_pool.setExpiryTimeout( -1 );
+    if( m_placement.cpuCount() > 0 )
+      m_pool.setMaxThreadCount( m_placement.cpuCount() );
+  }
+
+  // stamped frames would come back as new input, over and over
+  if( !canWatch( inputDir, outputDir ) )
+    return;
+
+  QObject::connect( &m_watcher, SIGNAL( directoryChanged(QString) ), this, SLOT( rescan() ) );
+  QObject::connect( &m_timer, SIGNAL( timeout() ), this, SLOT( poll() ) );
+
+  m_watcher.addPath( inputDir );
+
+  // frames which are there already are handled like new ones
+  rescan();
+}
+
+CWatchFolder::~CWatchFolder()
+{
+  m_timer.stop();
+  // abort running frames and wait for them before the job goes away
+  m_token.cancel();
+  m_pool.waitForDone();
+  delete m_job;
+}
+
+void CWatchFolder::bindCurrentThread()
+{
+  if( m_slots.hasLocalData() )
+    return;
+
+  int *slot = new int( m_nextSlot.fetchAndAddOrdered( 1 ) );
+  m_slots.setLocalData( slot );
+  m_placement.bindCurrentThread( *slot );
+}
+
+bool CWatchFolder::canWatch( const QString &inputDir, const QString &outputDir )
+{
+  QString input  = QDir( inputDir ).canonicalPath();
+  QString output = QDir( outputDir ).canonicalPath();
+
+  // the output directory may not exist yet, then it is not the input either
+  return output.isEmpty() || input != output;
+}
+
+void CWatchFolder::rescan()
+{
+  // all files, the same listing a regular run uses
+  QDir dir( m_inputDir );
+  dir.setFilter( QDir::Files );
+
+  foreach( const QFileInfo &info, dir.entryInfoList() )
+  {
+    const QString name = info.fileName();
+    if( m_pending.contains( name ) )
+      continue;
+
+    // unchanged since it settled
+    QHash<QString, Settled>::const_iterator settled = m_complete.constFind( name );
+    if( settled != m_complete.constEnd() && settled->size == info.size()
+        && settled->modified == info.lastModified() )
+      continue;
+
+    // new, or written to again (e.g. the writer only paused)
+    m_complete.remove( name );
+    m_submitted.remove( name );
+    m_retries.remove( name );
+    addPending( name );
+  }
+
+  if( !m_pending.isEmpty() && !m_timer.isActive() )
+    m_timer.start();
+}
+
+void CWatchFolder::addPending( const QString &name )
+{
+  Pending pending;
+  pending.size        = -1;
+  pending.stablePolls = 0;
+  m_pending.insert( name, pending );
+}
+
+void CWatchFolder::poll()
+{
+  QDir dir( m_inputDir );
+
+  QHash<QString, Pending>::iterator it = m_pending.begin();
+  while( it != m_pending.end() )
+  {
+    QFileInfo info( dir, it.key() );
+
+    // frame vanished again (e.g. renamed temporary file)
+    if( !info.exists() )
+    {
+      it = m_pending.erase( it );
+      continue;
+    }
+
+    // still growing?
+    if( info.size() != it->size )
+    {
+      it->size        = info.size();
+      it->stablePolls = 0;
+      ++it;
+      continue;
+    }
+
+    if( ++it->stablePolls < STABLE_POLLS )
+    {
+      ++it;
+      continue;
+    }
+
+    // empty files settle as well, they must not hold up the frames behind them
+    Settled settled;
+    settled.size     = info.size();
+    settled.modified = info.lastModified();
+    m_complete.insert( it.key(), settled );
+    it = m_pending.erase( it );
+  }
+
+  if( m_pending.isEmpty() )
+    m_timer.stop();
+
+  submitFrames();
+}
+
+void CWatchFolder::submitFrames()
+{
+  QDir dir( m_inputDir );
+  dir.setFilter( QDir::Files );
+  dir.setSorting( QDir::Name );
+
+  int seqNo = 0;
+
+  foreach( const QFileInfo &info, dir.entryInfoList() )
+  {
+    const QString name = info.fileName();
+
+    // a file still being written (or not seen yet) may be any frame, nothing behind it is certain
+    if( !m_complete.contains( name ) )
+      break;
+
+    // the sequence starts with the first readable image
+    if( seqNo == 0 && !QImageReader( info.absoluteFilePath() ).canRead() )
+      continue;
+    seqNo++;
+
+    // done already, unless an earlier frame arrived late and moved it
+    if( m_submitted.value( name, 0 ) == seqNo )
+      continue;
+
+    // one task per output, the frame is handed out again once the running one is done
+    if( m_running.contains( name ) )
+      continue;
+
+    m_submitted.insert( name, seqNo );
+    m_running.insert( name );
+    m_pool.start( new CWatchTask( this, m_job, info, seqNo, &m_token ) );
+  }
+}
+
+void CWatchFolder::frameDone( const QString &name, int seqNo, bool ok )
+{
+  m_running.remove( name );
+
+  // do not lose too much work if the application goes down
+  if( ++m_done % CACHE_SAVE_INTERVAL == 0 )
+    m_job->saveCache();
+
+  // failed with its current number: let it settle again and retry, unless it keeps failing
+  bool current = m_submitted.value( name, 0 ) == seqNo && m_complete.contains( name );
+  if( !ok && current && ++m_retries[name] < STAMP_RETRIES )
+  {
+    m_complete.remove( name );
+    m_submitted.remove( name );
+    addPending( name );
+    if( !m_timer.isActive() )
+      m_timer.start();
+  }
+
+  emit frameStamped( name, seqNo, ok );
+
+  // a frame that got a new number meanwhile is still to be stamped
+  submitFrames();
+}
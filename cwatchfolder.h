@@ -0,0 +1,140 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CWATCHFOLDER_H
+#define CWATCHFOLDER_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QAtomicInt>
+
+#include "ctimecodesettings.h"
+#include "ccanceltoken.h"
+#include "cworkerplacement.h"
+
+class CTimecodeJob;
+
+//! stamps frames of a growing sequence as soon as they are completely written
+/*!
+ * The input directory is watched for new files. A new file is considered
+ * complete once its size did not change for a couple of polls. Frames are
+ * numbered exactly like CTimecodeJob::scan() does: all files sorted by
+ * name, starting with the first readable image. A frame is only stamped
+ * when every file before it is complete. Should an earlier frame show up
+ * later on, the frames behind it are stamped again with their new timecode.
+ *
+ * A file that changes after it was considered complete waits to settle
+ * again and is stamped anew, a failed frame is retried a couple of times.
+ * There is at most one task per frame, a frame whose number changed while
+ * it was being stamped is stamped again once that task is done.
+ *
+ * The pool threads are bound with CWorkerPlacement like the workers of
+ * CJobQueue, each one as a worker number of its own.
+ */
+class CWatchFolder : public QObject
+{
+  Q_OBJECT
+
+public:
+  CWatchFolder( const QString &inputDir, const QString &outputDir, const CTimecodeSettings &settings,
+                const CWorkerPlacement &placement = CWorkerPlacement(), QObject *parent = 0 );
+  ~CWatchFolder();
+
+  //! whether stamped frames written to outputDir stay out of inputDir
+  static bool canWatch( const QString &inputDir, const QString &outputDir );
+
+signals:
+  //! a frame has been stamped (or failed to)
+  void frameStamped( const QString &name, int seqNo, bool ok );
+
+private slots:
+  //! the directory content changed
+  void rescan();
+  //! check pending frames for completeness and stamp what can be numbered
+  void poll();
+  //! a worker is done with a frame
+  void frameDone( const QString &name, int seqNo, bool ok );
+
+private:
+  friend class CWatchTask;
+
+  //! bind the calling pool thread, once per thread
+  void bindCurrentThread();
+  //! hand out every complete frame whose sequence number is certain
+  void submitFrames();
+  //! watch a new or changed file until its size settles
+  void addPending( const QString &name );
+
+  //! size observations of a frame still being written
+  struct Pending
+  {
+    qint64 size;
+    int stablePolls;
+  };
+
+  //! size and time stamp of a frame when it was considered complete
+  struct Settled
+  {
+    qint64 size;
+    QDateTime modified;
+  };
+
+  //! the input directory
+  QString m_inputDir;
+  //! does the actual stamping and caching
+  CTimecodeJob *m_job;
+  //! notifies about new files
+  QFileSystemWatcher m_watcher;
+  //! drives the completeness checks
+  QTimer m_timer;
+  //! files seen but not yet complete, keyed by file name
+  QHash<QString, Pending> m_pending;
+  //! files whose size has settled
+  QHash<QString, Settled> m_complete;
+  //! frames handed to the workers with the sequence number they got
+  QHash<QString, int> m_submitted;
+  //! frames a worker is busy with
+  QSet<QString> m_running;
+  //! failed attempts per frame since it settled
+  QHash<QString, int> m_retries;
+  //! frames done (stamped or failed) since watching started
+  int m_done;
+  //! binds the pool threads to cpus
+  CWorkerPlacement m_placement;
+  //! worker number of each pool thread that has been bound (outlives the pool threads)
+  QThreadStorage<int*> m_slots;
+  //! worker number of the next pool thread
+  QAtomicInt m_nextSlot;
+  //! workers stamping the frames
+  QThreadPool m_pool;
+  //! aborts running frames when watching stops
+  CCancelToken m_token;
+};
+
+#endif // CWATCHFOLDER_H
@@ -0,0 +1,166 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QtGlobal>
+
+#include "cworkerplacement.h"
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// topology as exported by the kernel
+#define SYSFS_NODES "/sys/devices/system/node"
+#define SYSFS_CPUS  "/sys/devices/system/cpu"
+
+// parse a kernel cpu list like "0-7,16-23"
+static QList<int> readCpuList( const QString &path )
+{
+  QList<int> cpus;
+
+  QFile file( path );
+  if( !file.open( QIODevice::ReadOnly ) )
+    return cpus;
+
+  foreach( const QString &range, QString( file.readAll() ).trimmed().split( ',', QString::SkipEmptyParts ) )
+  {
+    QStringList bounds = range.split( '-' );
+    int first = bounds.first().toInt();
+    int last  = bounds.last().toInt();
+    for( int cpu = first; cpu <= last; cpu++ )
+      cpus.append( cpu );
+  }
+
+  return cpus;
+}
+
+CWorkerPlacement::CWorkerPlacement( Policy policy )
+  : m_policy( policy )
+{
+  if( m_policy != Unpinned )
+    detect();
+}
+
+CWorkerPlacement::Policy CWorkerPlacement::policy() const
+{
+  return m_policy;
+}
+
+int CWorkerPlacement::nodeCount() const
+{
+  return m_nodes.size();
+}
+
+int CWorkerPlacement::cpuCount() const
+{
+  int count = 0;
+  for( int i = 0; i < m_nodes.size(); i++ )
+    count += m_nodes[i].size();
+  return count;
+}
+
+bool CWorkerPlacement::bindCurrentThread( int index ) const
+{
+  if( m_policy == Unpinned || m_nodes.isEmpty() )
+    return false;
+
+#ifdef Q_OS_LINUX
+  // nodes take turns, so a few workers already cover all sockets
+  const QList<int> &cpus = m_nodes.at( index % m_nodes.size() );
+
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  if( m_policy == Cores )
+    CPU_SET( cpus.at( (index / m_nodes.size()) % cpus.size() ), &set );
+  else
+  {
+    foreach( int cpu, cpus )
+      CPU_SET( cpu, &set );
+  }
+
+  return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+  Q_UNUSED( index );
+  return false;
+#endif
+}
+
+CWorkerPlacement::Policy CWorkerPlacement::policyFromString( const QString &name )
+{
+  if( name.compare( "nodes", Qt::CaseInsensitive ) == 0 )
+    return Nodes;
+  if( name.compare( "cores", Qt::CaseInsensitive ) == 0 )
+    return Cores;
+  return Unpinned;
+}
+
+void CWorkerPlacement::detect()
+{
+#ifdef Q_OS_LINUX
+  // only cpus the process may run on at all
+  cpu_set_t allowed;
+  CPU_ZERO( &allowed );
+  if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 )
+    return;
+
+  QList< QList<int> > nodes;
+  QDir dir( SYSFS_NODES );
+  foreach( const QString &name, dir.entryList( QStringList( "node*" ), QDir::Dirs, QDir::Name ) )
+    nodes.append( readCpuList( dir.filePath( name + "/cpulist" ) ) );
+
+  // kernels without NUMA support form one node
+  if( nodes.isEmpty() )
+    nodes.append( readCpuList( SYSFS_CPUS "/online" ) );
+
+  foreach( const QList<int> &cpus, nodes )
+  {
+    // first thread of every physical core, then their hyperthread siblings
+    QList<int> primary, siblings;
+    foreach( int cpu, cpus )
+    {
+      if( cpu >= CPU_SETSIZE || !CPU_ISSET( cpu, &allowed ) )
+        continue;
+
+      // a sibling with a lower number we may use owns the core already
+      bool first = true;
+      foreach( int thread, readCpuList( QString( SYSFS_CPUS "/cpu%1/topology/thread_siblings_list" ).arg( cpu ) ) )
+      {
+        if( thread < cpu && thread < CPU_SETSIZE && CPU_ISSET( thread, &allowed ) )
+          first = false;
+      }
+
+      if( first )
+        primary.append( cpu );
+      else
+        siblings.append( cpu );
+    }
+
+    // memory only nodes or nodes outside our cpuset
+    if( !primary.isEmpty() || !siblings.isEmpty() )
+      m_nodes.append( primary + siblings );
+  }
+#endif
+}
@@ -0,0 +1,74 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#ifndef CWORKERPLACEMENT_H
+#define CWORKERPLACEMENT_H
+
+#include <QList>
+#include <QString>
+
+//! decides on which cpus a worker thread may run
+/*!
+ * Workers are spread over the NUMA nodes in turn. A frame is decoded,
+ * stamped and encoded by one worker, so with the worker bound to a node
+ * all its buffers are first touched, and thus allocated, on that node.
+ * The topology is read from sysfs and restricted to the cpus the process
+ * may use (taskset, cpusets). Binding is only supported on Linux, it is
+ * silently skipped elsewhere.
+ */
+class CWorkerPlacement
+{
+public:
+  //! how workers are bound
+  enum Policy
+  {
+    Unpinned,  //!< leave placement to the scheduler
+    Nodes,     //!< bind each worker to all cpus of one node
+    Cores      //!< bind each worker to a single cpu, physical cores first
+  };
+
+  CWorkerPlacement( Policy policy = Unpinned );
+
+  //! the configured policy
+  Policy policy() const;
+  //! number of nodes with usable cpus
+  int nodeCount() const;
+  //! number of usable cpus
+  int cpuCount() const;
+
+  //! bind the calling thread as worker number index
+  bool bindCurrentThread( int index ) const;
+
+  //! parse "none", "nodes" or "cores" (anything else gives Unpinned)
+  static Policy policyFromString( const QString &name );
+
+private:
+  //! read the topology of this machine
+  void detect();
+
+  //! the configured policy
+  Policy m_policy;
+  //! usable cpus of each node, physical cores first
+  QList< QList<int> > m_nodes;
+};
+
+#endif // CWORKERPLACEMENT_H
@@ -0,0 +1,12 @@
+# stream very large png frames through libpng: used when pkg-config finds it,
+# "qmake CONFIG+=libpng" links -lpng without pkg-config, "CONFIG+=nolibpng" never uses it
+!nolibpng {
+    packagesExist( libpng ) {
+        CONFIG += link_pkgconfig
+        PKGCONFIG += libpng
+        DEFINES += HAVE_LIBPNG
+    } else:libpng {
+        DEFINES += HAVE_LIBPNG
+        LIBS += -lpng
+    }
+}
@@ -21,10 +21,46 @@
 
 
 #include <QtGui/QApplication>
+#include <QTextStream>
+#include <QString>
+#include <cstring>
+#include <cstdlib>
 #include "mainwindow.h"
+#include "crenderverifier.h"
 
 int main(int argc, char *argv[])
 {
+  // "--verify[=tolerance]" checks the overlay paths without showing the gui,
+  // "--golden=<dir>" compares them with the golden images "--record=<dir>" writes
+  bool verify = false;
+  int tolerance = VERIFY_TOLERANCE;
+  QString goldenDir, recordDir;
+  for( int i = 1; i < argc; i++ )
+  {
+    if( strncmp( argv[i], "--verify", 8 ) == 0 )
+    {
+      verify = true;
+      if( argv[i][8] == '=' )
+        tolerance = atoi( argv[i] + 9 );
+    }
+    else if( strncmp( argv[i], "--golden=", 9 ) == 0 )
+      goldenDir = QString::fromLocal8Bit( argv[i] + 9 );
+    else if( strncmp( argv[i], "--record=", 9 ) == 0 )
+      recordDir = QString::fromLocal8Bit( argv[i] + 9 );
+  }
+
+  if( verify || !recordDir.isEmpty() )
+  {
+    // fonts have to be rendered the way a regular run renders them, on X11 that
+    // needs the display connection: on headless nodes run it under xvfb-run
+    QApplication a(argc, argv);
+    CRenderVerifier verifier( tolerance, goldenDir );
+    QTextStream out( stdout );
+    if( !recordDir.isEmpty() )
+      return verifier.record( recordDir, out ) ? 0 : 1;
+    return verifier.run( out ) ? 0 : 1;
+  }
+
   QApplication a(argc, argv);
   MainWindow w;
   w.show();
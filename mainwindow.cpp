@@ -30,19 +30,77 @@
 #include <QColorDialog>
 #include <QApplication>
 #include <QProgressBar>
-
-#include <sstream>
+#include <QTreeWidget>
+#include <QImageReader>
+#include <QThread>
 
 #include "mainwindow.h"
+#include "cjobcache.h"
+#include "cjobqueue.h"
+#include "ctimecodejob.h"
+#include "ctimecoderenderer.h"
+#include "cwatchfolder.h"
+#include "cstriprenderer.h"
+#include "cglyphcache.h"
+#include "cworkerplacement.h"
+
+// interval in milliseconds to process events while a frame is being stamped
+#define EVENT_INTERVAL 50
+
+//! stamps a single frame while the gui keeps processing events
+class CFrameThread : public QThread
+{
+public:
+  CFrameThread( const QString &input, const QString &output, const CTimecodeSettings &settings,
+                unsigned int seqNo, const CCancelToken *token, const CWorkerPlacement &placement )
+    : stamped( false ), m_input( input ), m_output( output ), m_settings( settings ),
+    m_seqNo( seqNo ), m_token( token ), m_placement( placement ) {}
+
+  //! whether the frame has been written
+  bool stamped;
+  //! the stamped frame for the preview (null for streamed frames)
+  QImage image;
+
+protected:
+  void run()
+  {
+    // one frame at a time, so always worker number 0
+    m_placement.bindCurrentThread( 0 );
 
-#define RECTALPHA 102
+    // very large frames are streamed and never loaded
+    if( CStripRenderer::canStream( m_input ) )
+    {
+      stamped = CTimecodeRenderer::processFrame( m_input, m_output, m_settings, m_seqNo, m_token );
+      return;
+    }
+
+    image.load( m_input );
+    if( m_token->isCancelled() )
+      return;
+    stamped = CTimecodeRenderer::processFrame( image, m_output, m_settings, m_seqNo, m_token );
+  }
+
+private:
+  QString m_input;
+  QString m_output;
+  CTimecodeSettings m_settings;
+  unsigned int m_seqNo;
+  const CCancelToken *m_token;
+  CWorkerPlacement m_placement;
+};
 
 MainWindow::MainWindow(QWidget *parent, Qt::WFlags flags)
   : QMainWindow(parent, flags), m_scene( NULL ), m_pixmap( NULL ),
-  m_text( NULL ), m_rectangle( NULL ), m_group( NULL ), m_stopflag( false ), m_settings( "nesono.com", "timecode" )
+  m_text( NULL ), m_rectangle( NULL ), m_group( NULL ), m_settings( "nesono.com", "timecode" ),
+  m_queue( NULL ), m_watch( NULL )
 {
   ui.setupUi(this);
 
+  // create the batch queue
+  m_queue = new CJobQueue( this );
+  QObject::connect( m_queue, SIGNAL( jobProgress(int,int,int) ), this, SLOT( updateJobProgress(int,int,int) ) );
+  QObject::connect( m_queue, SIGNAL( finished() ), this, SLOT( queueFinished() ) );
+
   // create a status bar
 
   m_statusBar = new QStatusBar( this );
@@ -90,6 +148,10 @@ MainWindow::MainWindow(QWidget *parent, Qt::WFlags flags)
   ui.ui_font_name->setFont( m_settings.value( "font_name", ui.ui_font_name->font() ).value<QFont>() );
   ui.ui_font_name->setText( ui.ui_font_name->font().family() );
 
+  // render nodes with little memory stream frames earlier
+  CStripRenderer::setStreamThreshold( m_settings.value( "stream_pixels", STREAM_PIXELS ).toLongLong(),
+                                      m_settings.value( "stream_width", STREAM_WIDTH ).toInt() );
+
   // setup preview
   setupPreview();
 }
@@ -97,6 +159,8 @@ MainWindow::MainWindow(QWidget *parent, Qt::WFlags flags)
 MainWindow::~MainWindow()
 {
   setStopFlag();
+  // stop watching
+  delete m_watch;
   // save settings
   m_settings.setValue( "inputdir", ui.ui_input_dir->text() );
   m_settings.setValue( "outputdir", ui.ui_output_dir->text() );
@@ -105,6 +169,12 @@ MainWindow::~MainWindow()
   m_settings.setValue( "pos_y", ui.ui_pos_y->value() );
   m_settings.setValue( "fps", ui.ui_framerate->value() );
 
+  // no gui for these, keep them visible in the settings file
+  m_settings.setValue( "workers", m_settings.value( "workers", 0 ) );
+  m_settings.setValue( "worker_placement", m_settings.value( "worker_placement", "none" ) );
+  m_settings.setValue( "stream_pixels", m_settings.value( "stream_pixels", STREAM_PIXELS ) );
+  m_settings.setValue( "stream_width", m_settings.value( "stream_width", STREAM_WIDTH ) );
+
   // set defaut font color
   QPalette palette = ui.ui_color->palette();
   m_settings.setValue( "font_color", palette.color( QPalette::Base ) );
@@ -128,7 +198,7 @@ MainWindow::~MainWindow()
 // to enable stop flag and cancel button
 void MainWindow::enableStopFlag()
 {
-  m_stopflag = false;
+  m_stopflag.reset();
   ui.ui_cancel_button->setEnabled( true );
 }
 
@@ -149,13 +219,13 @@ void MainWindow::processImages()
   // go through file list
   QFileInfoList::const_iterator it = list.begin();
 
-  QPixmap pixmap;
   // go through file list until an image has been found...
   enableStopFlag();
   // disable group being movable
   m_group->setFlag( QGraphicsItem::ItemIsMovable, false );
 
-  while( pixmap.isNull() )
+  // only the header is checked, frames may be too large to load twice
+  while( it == list.end() || !QImageReader( it->absoluteFilePath() ).canRead() )
   {
     if( it == list.end() )
     {
@@ -169,7 +239,7 @@ void MainWindow::processImages()
       return;
     }
 
-    if( m_stopflag )
+    if( m_stopflag.isCancelled() )
     {
       m_statusBar->showMessage("Job cancelled" );
       // reset the stop flag
@@ -179,43 +249,25 @@ void MainWindow::processImages()
       return;
     }
 
-    // get first picture width/height
-    pixmap = QPixmap ( it->absoluteFilePath() );
-
-    // check if we just opened a pixmap
-    if( pixmap.isNull() )
-    {
-      // step ahead if no pixmap is opened
-      it++;
-      continue;
-    }
+    // step ahead if no image can be read
+    it++;
   }
-  // get size of first picture
-  QSize picSize = pixmap.size();
 
-  // time info variables
+  // sequence (frame) number
   unsigned int seqNo = 1;
-  unsigned int hour, min, secs;
-  unsigned int x, y, w, v;
-  float        framerate;
-
-  QFont font = ui.ui_font_name->font();
-  unsigned int fontSize = (font.pixelSize() == -1 ? font.pointSize() : font.pixelSize());
-  x = ui.ui_pos_x->value() + fontSize/4;
-  y = ui.ui_pos_y->value() + fontSize + fontSize/16;
-
-  // specify position of rounded rectangle
-  v = ui.ui_pos_x->value();
-  w = ui.ui_pos_y->value();
 
-  unsigned int width, height;
-  width  = m_text->boundingRect().width() + fontSize/2;
-  height = m_text->boundingRect().height();
+  // overlay parameters from the user interface
+  CTimecodeSettings settings = currentSettings();
+  float framerate = settings.framerate;
 
-  qreal radius = fontSize/5.0;
-
-  // get framerate from spin box
-  framerate = ui.ui_framerate->value();
+  // cache of frames that are already up to date in the output directory
+  CJobCache cache( ui.ui_output_dir->text(), settings.fingerprint() );
+  // read the topology once, not for every frame
+  CWorkerPlacement placement = workerPlacement();
+  // glyphs for the whole run, the frame thread must never rasterize them
+  QSharedPointer<const CGlyphCache> glyphs = CGlyphCache::get( settings );
+  // number of frames skipped due to the cache
+  unsigned int skipped = 0;
 
   // remember old pixmap
   QPixmap old_pixmap = m_pixmap->pixmap();
@@ -235,7 +287,7 @@ void MainWindow::processImages()
 
   for ( ; it != list.end(); it++, progress++ )
   {
-    if( m_stopflag )
+    if( m_stopflag.isCancelled() )
     {
       // remove progress bar
       m_statusBar->removeWidget( progressBar );
@@ -258,70 +310,31 @@ void MainWindow::processImages()
     // apply progress bar value
     progressBar->setValue( progress );
 
-    // calculate timecode
-    QPixmap pixmap( it->absoluteFilePath() );
+    // skip frames which have been stamped with the same settings before
+    QString outputPath = ui.ui_output_dir->text() +"/" + it->baseName() + ".png";
+    if( cache.isUpToDate( *it, seqNo, outputPath ) )
+    {
+      skipped++;
+      seqNo++;
+      continue;
+    }
 
     // show status bar message
     m_statusBar->showMessage( QString( "processing: ") + it->baseName() );
     QApplication::processEvents();
 
-    // get number of overall seconds:
-    secs = static_cast<unsigned int>( seqNo / framerate );
-    // get remaining frames in second
-    unsigned int frame = static_cast<unsigned int>( seqNo - (secs*framerate ) );
-    // get overall hours and subtract seconds in the hours from the secs
-    hour = static_cast<unsigned int>( secs / 3600 );
-    secs -= hour * 3600;
-    // get overall minutes and subtract them from secs
-    min = static_cast<unsigned int>( secs / 60 );
-    secs -= min * 60;
-
-    // create painter object
-    QPainter painter( &pixmap );
-
-    // get brush from painter
-    QBrush brush = painter.brush();
-    // get color from frame color widget
-    QColor color = ui.ui_frame_color->palette().color( QPalette::Base );
-    // set alpha value (to 40%)
-    color.setAlpha( RECTALPHA );
-    // set brushes color
-    brush.setColor( color );
-    // set to solid
-    brush.setStyle( Qt::SolidPattern );
-    // reapply brush
-    painter.setBrush( brush );
-    // reset pen
-    painter.setPen( Qt::NoPen );
-
-    // draw rounded rectangle
-    painter.drawRoundedRect( v, w, width, height, radius, radius );
-
-    // get font from font-widget and set it
-    painter.setFont(  font );
-
-    // get color from color widget and set it
-    painter.setPen( ui.ui_color->palette().color( QPalette::Base ) );
-
-    // create a string for the timecode
-    std::stringstream tcstring;
-    tcstring.fill( '0' );
-    tcstring.width( 2 );
-    tcstring << hour << ":";
-    tcstring.width( 2 );
-    tcstring << min << ":";
-    tcstring.width( 2 );
-    tcstring << secs << ".";
-    tcstring.width( 2 );
-    tcstring << frame;
-    painter.drawText( x, y, tcstring.str().c_str()
-                      /*QString( "%1:%2:%3.%4" ).arg( hour,2 ).arg( min,2 ).arg( secs,2 ).arg( frame,2 )*/ );
-
-    pixmap.save( ui.ui_output_dir->text() +"/" + it->baseName() + ".png", "PNG", 100 );
+    // stamp and save the frame in the background, so a cancel gets through meanwhile
+    CFrameThread frame( it->absoluteFilePath(), outputPath, settings, seqNo, &m_stopflag, placement );
+    frame.start();
+    while( !frame.wait( EVENT_INTERVAL ) )
+      QApplication::processEvents();
+
+    if( frame.stamped )
+      cache.update( *it, seqNo, outputPath );
 
     // show preview (every second)
-    if( seqNo % static_cast<int>( framerate ) == 1 )
-      m_pixmap->setPixmap( pixmap );
+    if( seqNo % static_cast<int>( framerate ) == 1 && frame.stamped && !frame.image.isNull() )
+      m_pixmap->setPixmap( QPixmap::fromImage( frame.image ) );
 
     // advance sequence (frame) number
     seqNo++;
@@ -343,7 +356,36 @@ void MainWindow::processImages()
   // reshow rectangle
   m_rectangle->show();
   // show status bar message
-  m_statusBar->showMessage( "processing finished" );
+  if( skipped > 0 )
+    m_statusBar->showMessage( QString( "processing finished (%1 frames up to date)" ).arg( skipped ) );
+  else
+    m_statusBar->showMessage( "processing finished" );
+}
+
+// worker_placement in the settings file: none, nodes or cores
+CWorkerPlacement MainWindow::workerPlacement() const
+{
+  return CWorkerPlacement( CWorkerPlacement::policyFromString( m_settings.value( "worker_placement", "none" ).toString() ) );
+}
+
+// collect the overlay settings from the user interface
+CTimecodeSettings MainWindow::currentSettings() const
+{
+  CTimecodeSettings settings;
+
+  settings.framerate  = ui.ui_framerate->value();
+  settings.font       = ui.ui_font_name->font();
+  // the preview is measured on screen
+  settings.dpi        = ui.ui_font_name->logicalDpiY();
+  settings.textColor  = ui.ui_color->palette().color( QPalette::Base );
+  settings.frameColor = ui.ui_frame_color->palette().color( QPalette::Base );
+  settings.posX       = ui.ui_pos_x->value();
+  settings.posY       = ui.ui_pos_y->value();
+
+  // measured like the preview text, the glyph cache keeps it per font
+  settings.updateBadgeSize();
+
+  return settings;
 }
 
 // function to setup preview
@@ -364,7 +406,7 @@ void MainWindow::setupPreview()
   // go through file list until an image has been found...
   while( pixmap.isNull() && it != list.end() )
   {
-    if( m_stopflag )
+    if( m_stopflag.isCancelled() )
     {
       m_statusBar->showMessage("Job cancelled", 5000 );
       return;
@@ -627,7 +669,141 @@ void MainWindow::process()
 // functin to cancel a running job
 void MainWindow::setStopFlag()
 {
-  m_stopflag = true;
+  m_stopflag.cancel();
   ui.ui_cancel_button->setEnabled( false );
   QApplication::processEvents();
 }
+
+// enqueue the current directories and settings as batch job
+void MainWindow::addJob()
+{
+  // same checks as for a single run
+  if( ui.ui_input_dir->text().isEmpty() || ui.ui_output_dir->text().isEmpty() || ui.ui_framerate->value() <= 0.0 )
+  {
+    QMessageBox::critical( this, "Queue Error", "Please specify input directory, output directory and framerate", QMessageBox::Ok, QMessageBox::Cancel );
+    return;
+  }
+
+  enqueueJob( new CTimecodeJob( ui.ui_input_dir->text(), ui.ui_output_dir->text(), currentSettings() ) );
+}
+
+// load batch jobs from a job file
+void MainWindow::loadJobs()
+{
+  QString path = QFileDialog::getOpenFileName( this, tr("Open Job File"), "", tr("Job Files (*.ini *.jobs);;All Files (*)") );
+  if( path.isEmpty() )
+    return;
+
+  // jobs inherit everything they do not specify from the user interface
+  QList<CTimecodeJob*> jobs = CTimecodeJob::loadJobFile( path, currentSettings() );
+  if( jobs.isEmpty() )
+  {
+    QMessageBox::critical( this, "Queue Error", "No valid jobs found in " + path, QMessageBox::Ok, QMessageBox::Cancel );
+    return;
+  }
+
+  foreach( CTimecodeJob *job, jobs )
+    enqueueJob( job );
+}
+
+// run all queued jobs
+void MainWindow::runQueue()
+{
+  ui.ui_job_cancel->setEnabled( true );
+  ui.ui_job_run->setEnabled( false );
+  m_statusBar->showMessage( "running queued jobs..." );
+
+  // render nodes tune the number of workers in the settings file (0 = one per cpu)
+  m_queue->setPlacement( workerPlacement() );
+  m_queue->start( m_settings.value( "workers", 0 ).toInt() );
+}
+
+// cancel queued jobs
+void MainWindow::cancelQueue()
+{
+  // the single run has its own cancel button
+  ui.ui_job_cancel->setEnabled( false );
+  m_queue->cancel();
+}
+
+// show progress of a job in the job list
+void MainWindow::updateJobProgress( int id, int done, int total )
+{
+  QTreeWidgetItem *item = ui.ui_job_list->topLevelItem( id );
+  if( item == NULL )
+    return;
+
+  QProgressBar *progressBar = static_cast<QProgressBar*>( ui.ui_job_list->itemWidget( item, 2 ) );
+  progressBar->setRange( 0, total );
+  progressBar->setValue( done );
+}
+
+// all queued jobs are done
+void MainWindow::queueFinished()
+{
+  ui.ui_job_run->setEnabled( true );
+  ui.ui_job_cancel->setEnabled( false );
+  m_statusBar->showMessage( "queued jobs finished" );
+}
+
+// add a job to the queue and the job list
+void MainWindow::enqueueJob( CTimecodeJob *job )
+{
+  // the list item has to exist before the queue reports progress
+  QTreeWidgetItem *item = new QTreeWidgetItem( ui.ui_job_list );
+  item->setText( 0, job->inputDir() );
+  item->setText( 1, job->outputDir() );
+  ui.ui_job_list->setItemWidget( item, 2, new QProgressBar() );
+
+  QString outputDir = job->outputDir();
+  if( m_queue->enqueue( job ) < 0 )
+  {
+    // job ids are list rows, the refused job must not keep one
+    delete item;
+    QMessageBox::critical( this, "Queue Error", "Another job already writes to " + outputDir, QMessageBox::Ok, QMessageBox::Cancel );
+  }
+}
+
+// start or stop watching the input directory
+void MainWindow::toggleWatch( bool on )
+{
+  // stop a running watcher in any case
+  delete m_watch;
+  m_watch = NULL;
+
+  if( !on )
+  {
+    m_statusBar->showMessage( "stopped watching input directory", 2000 );
+    return;
+  }
+
+  if( ui.ui_input_dir->text().isEmpty() || ui.ui_output_dir->text().isEmpty() || ui.ui_framerate->value() <= 0.0 )
+  {
+    QMessageBox::critical( this, "Watch Error", "Please specify input directory, output directory and framerate", QMessageBox::Ok, QMessageBox::Cancel );
+    ui.ui_watch_button->setChecked( false );
+    return;
+  }
+
+  if( !CWatchFolder::canWatch( ui.ui_input_dir->text(), ui.ui_output_dir->text() ) )
+  {
+    QMessageBox::critical( this, "Watch Error", "Output directory must differ from input directory, stamped frames would be stamped again", QMessageBox::Ok, QMessageBox::Cancel );
+    ui.ui_watch_button->setChecked( false );
+    return;
+  }
+
+  // settings are frozen while watching
+  m_watch = new CWatchFolder( ui.ui_input_dir->text(), ui.ui_output_dir->text(), currentSettings(),
+                              workerPlacement(), this );
+  QObject::connect( m_watch, SIGNAL( frameStamped(QString,int,bool) ), this, SLOT( watchFrameStamped(QString,int,bool) ) );
+
+  m_statusBar->showMessage( "watching " + ui.ui_input_dir->text() );
+}
+
+// a watched frame has been stamped
+void MainWindow::watchFrameStamped( const QString &name, int seqNo, bool ok )
+{
+  if( ok )
+    m_statusBar->showMessage( QString( "stamped: %1 (frame %2)" ).arg( name ).arg( seqNo ) );
+  else
+    m_statusBar->showMessage( QString( "failed to stamp: %1" ).arg( name ) );
+}
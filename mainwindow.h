@@ -30,6 +30,13 @@
 
 #include "ui_mainwindow.h"
 #include "ctimecodeitemgroup.h"
+#include "ctimecodesettings.h"
+#include "ccanceltoken.h"
+#include "cworkerplacement.h"
+
+class CJobQueue;
+class CTimecodeJob;
+class CWatchFolder;
 
 class MainWindow : public QMainWindow
 {
@@ -45,6 +52,8 @@ public:
   void processImages();
   //! function to setup the preview
   void setupPreview();
+  //! collect the overlay settings from the user interface
+  CTimecodeSettings currentSettings() const;
 
 public slots:
   //! function-slot to browse for the input directory
@@ -65,8 +74,29 @@ public slots:
   void process();
   //! functin to cancel a running job
   void setStopFlag();
+  //! enqueue the current directories and settings as batch job
+  void addJob();
+  //! load batch jobs from a job file
+  void loadJobs();
+  //! run all queued jobs
+  void runQueue();
+  //! cancel queued jobs
+  void cancelQueue();
+  //! show progress of a job in the job list
+  void updateJobProgress( int id, int done, int total );
+  //! all queued jobs are done
+  void queueFinished();
+  //! start or stop watching the input directory
+  void toggleWatch( bool on );
+  //! a watched frame has been stamped
+  void watchFrameStamped( const QString &name, int seqNo, bool ok );
 
 private:
+  //! add a job to the queue and the job list
+  void enqueueJob( CTimecodeJob *job );
+  //! how worker threads are bound to cpus, from the settings file
+  CWorkerPlacement workerPlacement() const;
+
   //! the userinterface, created by uic
   Ui::MainWindowClass ui;
   //! the graphics scene for the preview
@@ -82,9 +112,13 @@ private:
   //! the status bar of the main window
   QStatusBar *m_statusBar;
   //! the stop flag for cancelling jobs
-  bool m_stopflag;
+  CCancelToken m_stopflag;
   //! to remember settings from previous session
   QSettings m_settings;
+  //! the batch queue
+  CJobQueue *m_queue;
+  //! watcher for incremental processing (NULL if not watching)
+  CWatchFolder *m_watch;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,6 @@
+# pixel kernels against QPainter, plus benchmarks ("-iterations n" or "-tickcounter")
+TARGET = tst_cpixelkernels
+include( ../tests.pri )
+SOURCES += tst_cpixelkernels.cpp \
+    ../../cpixelkernels.cpp
+HEADERS += ../../cpixelkernels.h
@@ -0,0 +1,384 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QtTest/QtTest>
+#include <QImage>
+#include <QPainter>
+#include <QVector>
+
+#include "cpixelkernels.h"
+
+// odd width, so vector loops and remainders are both exercised
+#define ROW_WIDTH   1003
+#define ROW_COUNT   64
+// frame size for the benchmarks
+#define BENCH_WIDTH 1920
+#define BENCH_ROWS  120
+
+Q_DECLARE_METATYPE( CPixelKernels::InstructionSet )
+
+//! every kernel against QPainter (or an exact reference where QPainter has no such format)
+class TestPixelKernels : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void cleanup();
+
+  void blendPremultiplied_data();
+  void blendPremultiplied();
+  void blendARGB32_data();
+  void blendARGB32();
+  void blendRGB16_data();
+  void blendRGB16();
+  void convertIndexed8_data();
+  void convertIndexed8();
+
+  void benchBlendPremultiplied_data();
+  void benchBlendPremultiplied();
+  void benchQPainter();
+  void benchBlendARGB32();
+  void benchBlendRGB16();
+  void benchConvertIndexed8();
+
+private:
+  //! one row per instruction set the cpu supports
+  static void addInstructionSets();
+  //! a badge like overlay: premultiplied, all alpha values incl. 0 and 255
+  static QImage overlay( int width, int height );
+  //! a frame with random pixels in format
+  static QImage frame( int width, int height, QImage::Format format );
+  //! largest channel difference of two 32 bit pixels
+  static int difference( QRgb a, QRgb b );
+};
+
+void TestPixelKernels::cleanup()
+{
+  // back to what the application would use
+  CPixelKernels::setInstructionSet( CPixelKernels::bestInstructionSet() );
+}
+
+void TestPixelKernels::addInstructionSets()
+{
+  QTest::addColumn<CPixelKernels::InstructionSet>( "set" );
+
+  QTest::newRow( "generic" ) << CPixelKernels::Generic;
+  if( CPixelKernels::bestInstructionSet() >= CPixelKernels::SSE2 )
+    QTest::newRow( "sse2" ) << CPixelKernels::SSE2;
+  if( CPixelKernels::bestInstructionSet() >= CPixelKernels::AVX2 )
+    QTest::newRow( "avx2" ) << CPixelKernels::AVX2;
+}
+
+QImage TestPixelKernels::overlay( int width, int height )
+{
+  QImage image( width, height, QImage::Format_ARGB32_Premultiplied );
+
+  qsrand( 42 );
+  for( int y = 0; y < height; y++ )
+  {
+    QRgb *line = reinterpret_cast<QRgb*>( image.scanLine( y ) );
+    for( int x = 0; x < width; x++ )
+    {
+      // runs of transparent and opaque pixels, like around and inside the badge
+      int alpha = (x / 16) % 4 == 0 ? 0 : (x / 16) % 4 == 1 ? 255 : qrand() % 256;
+      line[x] = qRgba( qrand() % (alpha + 1), qrand() % (alpha + 1), qrand() % (alpha + 1), alpha );
+    }
+  }
+
+  return image;
+}
+
+QImage TestPixelKernels::frame( int width, int height, QImage::Format format )
+{
+  QImage image( width, height, QImage::Format_ARGB32 );
+
+  qsrand( 7 );
+  for( int y = 0; y < height; y++ )
+  {
+    QRgb *line = reinterpret_cast<QRgb*>( image.scanLine( y ) );
+    for( int x = 0; x < width; x++ )
+      line[x] = qRgba( qrand() % 256, qrand() % 256, qrand() % 256, qrand() % 256 );
+  }
+
+  return image.convertToFormat( format );
+}
+
+int TestPixelKernels::difference( QRgb a, QRgb b )
+{
+  return qMax( qMax( qAbs( qRed( a ) - qRed( b ) ), qAbs( qGreen( a ) - qGreen( b ) ) ),
+               qMax( qAbs( qBlue( a ) - qBlue( b ) ), qAbs( qAlpha( a ) - qAlpha( b ) ) ) );
+}
+
+void TestPixelKernels::blendPremultiplied_data()
+{
+  addInstructionSets();
+}
+
+void TestPixelKernels::blendPremultiplied()
+{
+  QFETCH( CPixelKernels::InstructionSet, set );
+  QVERIFY( CPixelKernels::setInstructionSet( set ) );
+
+  QImage source = overlay( ROW_WIDTH, ROW_COUNT );
+  const QImage::Format formats[] = { QImage::Format_RGB32, QImage::Format_ARGB32_Premultiplied };
+
+  for( int f = 0; f < 2; f++ )
+  {
+    QImage expected = frame( ROW_WIDTH, ROW_COUNT, formats[f] );
+    QImage result = expected;
+    {
+      QPainter painter( &expected );
+      painter.drawImage( 0, 0, source );
+    }
+
+    // misaligned rows too: start at every offset up to a vector width
+    for( int y = 0; y < ROW_COUNT; y++ )
+    {
+      int offset = y % 8;
+      CPixelKernels::blendPremultiplied( reinterpret_cast<unsigned int*>( result.scanLine( y ) ) + offset,
+                                         reinterpret_cast<const unsigned int*>( source.scanLine( y ) ) + offset,
+                                         ROW_WIDTH - offset );
+      memcpy( result.scanLine( y ), expected.scanLine( y ), offset * 4 );
+    }
+
+    // same rounding as the raster engine, so no tolerance
+    QCOMPARE( result, expected );
+  }
+}
+
+void TestPixelKernels::blendARGB32_data()
+{
+  addInstructionSets();
+}
+
+void TestPixelKernels::blendARGB32()
+{
+  QFETCH( CPixelKernels::InstructionSet, set );
+  QVERIFY( CPixelKernels::setInstructionSet( set ) );
+
+  QImage source   = overlay( ROW_WIDTH, ROW_COUNT );
+  QImage expected = frame( ROW_WIDTH, ROW_COUNT, QImage::Format_ARGB32 );
+  QImage result   = expected;
+  {
+    QPainter painter( &expected );
+    painter.drawImage( 0, 0, source );
+  }
+
+  for( int y = 0; y < ROW_COUNT; y++ )
+    CPixelKernels::blendARGB32( reinterpret_cast<unsigned int*>( result.scanLine( y ) ),
+                                reinterpret_cast<const unsigned int*>( source.scanLine( y ) ), ROW_WIDTH );
+
+  // compared premultiplied: colors of (almost) transparent pixels are not visible
+  QImage a = expected.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+  QImage b = result.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+  for( int y = 0; y < ROW_COUNT; y++ )
+  {
+    for( int x = 0; x < ROW_WIDTH; x++ )
+    {
+      int diff = difference( a.pixel( x, y ), b.pixel( x, y ) );
+      QVERIFY2( diff <= 1, qPrintable( QString( "pixel %1,%2 off by %3" ).arg( x ).arg( y ).arg( diff ) ) );
+    }
+  }
+}
+
+void TestPixelKernels::blendRGB16_data()
+{
+  QTest::addColumn<int>( "channels" );
+
+  QTest::newRow( "rgb" ) << 3;
+  QTest::newRow( "rgba" ) << 4;
+}
+
+void TestPixelKernels::blendRGB16()
+{
+  QFETCH( int, channels );
+
+  QImage source = overlay( ROW_WIDTH, 1 );
+  const QRgb *src = reinterpret_cast<const QRgb*>( source.scanLine( 0 ) );
+
+  // 16 bit frame, plus the same frame reduced to 8 bit for QPainter
+  QVector<unsigned short> row( ROW_WIDTH * channels );
+  QImage frame8( ROW_WIDTH, 1, channels == 4 ? QImage::Format_ARGB32 : QImage::Format_RGB32 );
+  qsrand( 3 );
+  for( int x = 0; x < ROW_WIDTH; x++ )
+  {
+    for( int c = 0; c < channels; c++ )
+      row[x * channels + c] = qrand() % 65536;
+    frame8.setPixel( x, 0, qRgba( row[x * channels] >> 8, row[x * channels + 1] >> 8, row[x * channels + 2] >> 8,
+                                  channels == 4 ? row[x * channels + 3] >> 8 : 255 ) );
+  }
+  QVector<unsigned short> original = row;
+
+  CPixelKernels::blendRGB16( row.data(), src, ROW_WIDTH, channels );
+
+  {
+    QPainter painter( &frame8 );
+    painter.drawImage( 0, 0, source );
+  }
+
+  for( int x = 0; x < ROW_WIDTH; x++ )
+  {
+    // exact source over in floating point
+    double sa = qAlpha( src[x] ) / 255.0;
+    double sc[3] = { qRed( src[x] ) / 255.0, qGreen( src[x] ) / 255.0, qBlue( src[x] ) / 255.0 };
+    double da = channels == 4 ? original[x * channels + 3] / 65535.0 : 1.0;
+    double oa = sa + da * (1.0 - sa);
+
+    if( channels == 4 )
+      QVERIFY( qAbs( row[x * channels + 3] - oa * 65535.0 ) <= 1.0 );
+
+    for( int c = 0; c < 3; c++ )
+    {
+      double dc = original[x * channels + c] / 65535.0;
+      double oc = oa > 0.0 ? (sc[c] + dc * da * (1.0 - sa)) / oa : 0.0;
+
+      // a rounding error grows by 1/alpha when unpremultiplied
+      double tolerance = 3.0 + 3.0 / oa;
+      QVERIFY2( qAbs( row[x * channels + c] - oc * 65535.0 ) <= tolerance,
+                qPrintable( QString( "pixel %1 channel %2: %3 instead of %4" ).arg( x ).arg( c )
+                            .arg( row[x * channels + c] ).arg( oc * 65535.0 ) ) );
+    }
+
+    // and the same as QPainter at 8 bit, apart from the precision
+    if( oa > 0.0 )
+    {
+      QRgb p = frame8.pixel( x, 0 );
+      int tolerance = 3 + int( 3.0 / oa );
+      QVERIFY( qAbs( (row[x * channels]     >> 8) - qRed( p ) )   <= tolerance );
+      QVERIFY( qAbs( (row[x * channels + 1] >> 8) - qGreen( p ) ) <= tolerance );
+      QVERIFY( qAbs( (row[x * channels + 2] >> 8) - qBlue( p ) )  <= tolerance );
+    }
+  }
+}
+
+void TestPixelKernels::convertIndexed8_data()
+{
+  QTest::addColumn<bool>( "alpha" );
+
+  QTest::newRow( "opaque" ) << false;
+  QTest::newRow( "alpha" ) << true;
+}
+
+void TestPixelKernels::convertIndexed8()
+{
+  QFETCH( bool, alpha );
+
+  QImage indexed( ROW_WIDTH, ROW_COUNT, QImage::Format_Indexed8 );
+  QVector<QRgb> colorTable;
+  for( int i = 0; i < 256; i++ )
+    colorTable << qRgba( i, 255 - i, i / 2, alpha ? i : 255 );
+  indexed.setColorTable( colorTable );
+
+  qsrand( 11 );
+  for( int y = 0; y < ROW_COUNT; y++ )
+  {
+    for( int x = 0; x < ROW_WIDTH; x++ )
+      indexed.scanLine( y )[x] = qrand() % 256;
+  }
+
+  QImage::Format format = alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+  QImage expected = indexed.convertToFormat( format );
+  QImage result( ROW_WIDTH, ROW_COUNT, format );
+  for( int y = 0; y < ROW_COUNT; y++ )
+    CPixelKernels::convertIndexed8( reinterpret_cast<unsigned int*>( result.scanLine( y ) ),
+                                    indexed.scanLine( y ), colorTable.constData(), ROW_WIDTH );
+
+  QCOMPARE( result, expected );
+}
+
+void TestPixelKernels::benchBlendPremultiplied_data()
+{
+  addInstructionSets();
+}
+
+void TestPixelKernels::benchBlendPremultiplied()
+{
+  QFETCH( CPixelKernels::InstructionSet, set );
+  QVERIFY( CPixelKernels::setInstructionSet( set ) );
+
+  QImage source = overlay( BENCH_WIDTH, BENCH_ROWS );
+  QImage target = frame( BENCH_WIDTH, BENCH_ROWS, QImage::Format_RGB32 );
+
+  QBENCHMARK
+  {
+    for( int y = 0; y < BENCH_ROWS; y++ )
+      CPixelKernels::blendPremultiplied( reinterpret_cast<unsigned int*>( target.scanLine( y ) ),
+                                         reinterpret_cast<const unsigned int*>( source.scanLine( y ) ), BENCH_WIDTH );
+  }
+}
+
+void TestPixelKernels::benchQPainter()
+{
+  // what the kernels replace
+  QImage source = overlay( BENCH_WIDTH, BENCH_ROWS );
+  QImage target = frame( BENCH_WIDTH, BENCH_ROWS, QImage::Format_RGB32 );
+
+  QBENCHMARK
+  {
+    QPainter painter( &target );
+    painter.drawImage( 0, 0, source );
+  }
+}
+
+void TestPixelKernels::benchBlendARGB32()
+{
+  QImage source = overlay( BENCH_WIDTH, BENCH_ROWS );
+  QImage target = frame( BENCH_WIDTH, BENCH_ROWS, QImage::Format_ARGB32 );
+
+  QBENCHMARK
+  {
+    for( int y = 0; y < BENCH_ROWS; y++ )
+      CPixelKernels::blendARGB32( reinterpret_cast<unsigned int*>( target.scanLine( y ) ),
+                                  reinterpret_cast<const unsigned int*>( source.scanLine( y ) ), BENCH_WIDTH );
+  }
+}
+
+void TestPixelKernels::benchBlendRGB16()
+{
+  QImage source = overlay( BENCH_WIDTH, BENCH_ROWS );
+  QVector<unsigned short> target( BENCH_WIDTH * BENCH_ROWS * 4, 0x8000 );
+
+  QBENCHMARK
+  {
+    for( int y = 0; y < BENCH_ROWS; y++ )
+      CPixelKernels::blendRGB16( target.data() + y * BENCH_WIDTH * 4,
+                                 reinterpret_cast<const unsigned int*>( source.scanLine( y ) ), BENCH_WIDTH, 4 );
+  }
+}
+
+void TestPixelKernels::benchConvertIndexed8()
+{
+  QImage indexed = frame( BENCH_WIDTH, BENCH_ROWS, QImage::Format_RGB32 ).convertToFormat( QImage::Format_Indexed8 );
+  QVector<QRgb> colorTable = indexed.colorTable();
+  colorTable.resize( 256 );
+  QImage target( BENCH_WIDTH, BENCH_ROWS, QImage::Format_RGB32 );
+
+  QBENCHMARK
+  {
+    for( int y = 0; y < BENCH_ROWS; y++ )
+      CPixelKernels::convertIndexed8( reinterpret_cast<unsigned int*>( target.scanLine( y ) ),
+                                      indexed.scanLine( y ), colorTable.constData(), BENCH_WIDTH );
+  }
+}
+
+QTEST_MAIN( TestPixelKernels )
+#include "tst_cpixelkernels.moc"
@@ -0,0 +1,20 @@
+# every overlay path against the QPainter reference, the checks of "timecode4 --verify"
+# golden/ holds the reference images, "timecode4 --record=tests/render/golden" rewrites them
+TARGET = tst_render
+include( ../tests.pri )
+include( ../../libpng.pri )
+DEFINES += GOLDEN_DIR=\\\"$$PWD/golden\\\"
+SOURCES += tst_render.cpp \
+    ../../crenderverifier.cpp \
+    ../../ctimecoderenderer.cpp \
+    ../../ctimecodesettings.cpp \
+    ../../cglyphcache.cpp \
+    ../../cstriprenderer.cpp \
+    ../../cpixelkernels.cpp
+HEADERS += ../../crenderverifier.h \
+    ../../ctimecoderenderer.h \
+    ../../ctimecodesettings.h \
+    ../../cglyphcache.h \
+    ../../cstriprenderer.h \
+    ../../cpixelkernels.h \
+    ../../ccanceltoken.h
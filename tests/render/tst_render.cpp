@@ -0,0 +1,84 @@
+/************************************************************************\
+
+                   Copyright 2009, Jochen Issing
+
+    This is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation; either version 2.1 of
+    the License, or (at your option) any later version.
+
+    This software is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this software; if not, write to the Free
+    Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+    02110-1301 USA, or see the FSF site: http://www.fsf.org.
+
+\************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include "crenderverifier.h"
+
+Q_DECLARE_METATYPE( CRenderVerifier::Path )
+
+//! the checks of "timecode4 --verify", one row per case and path, against the golden images
+class TestRender : public QObject
+{
+  Q_OBJECT
+
+public:
+  TestRender() : m_verifier( VERIFY_TOLERANCE, GOLDEN_DIR ) {}
+
+private slots:
+  void initTestCase();
+
+  void overlay_data();
+  void overlay();
+
+private:
+  QList<CRenderVerifier::Case> m_cases;
+  CRenderVerifier m_verifier;
+};
+
+void TestRender::initTestCase()
+{
+  m_cases = CRenderVerifier::cases();
+  QVERIFY( !m_cases.isEmpty() );
+}
+
+void TestRender::overlay_data()
+{
+  QTest::addColumn<int>( "index" );
+  QTest::addColumn<CRenderVerifier::Path>( "path" );
+
+  for( int i = 0; i < CRenderVerifier::cases().size(); i++ )
+  {
+    for( int path = 0; path < CRenderVerifier::PathCount; path++ )
+    {
+      // streaming paths only exist with libpng
+      if( !CRenderVerifier::isAvailable( CRenderVerifier::Path( path ) ) )
+        continue;
+
+      QString name = QString( "%1 %2" ).arg( i ).arg( CRenderVerifier::pathName( CRenderVerifier::Path( path ) ) );
+      QTest::newRow( qPrintable( name ) ) << i << CRenderVerifier::Path( path );
+    }
+  }
+}
+
+void TestRender::overlay()
+{
+  QFETCH( int, index );
+  QFETCH( CRenderVerifier::Path, path );
+
+  QString message;
+  bool ok = m_verifier.check( m_cases.at( index ), path, message );
+  QVERIFY2( ok, qPrintable( CRenderVerifier::caseName( m_cases.at( index ) ) + ": " + message ) );
+}
+
+QTEST_MAIN( TestRender )
+#include "tst_render.moc"
@@ -0,0 +1,11 @@
+# shared by all tests: sources are taken from the application directory
+TEMPLATE = app
+CONFIG += qtestlib
+CONFIG -= app_bundle
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+# "make check" runs the test
+check.commands = ./$$TARGET
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,9 @@
+# -------------------------------------------------
+# unit tests and benchmarks, "qmake && make && make check" runs them all
+# -------------------------------------------------
+TEMPLATE = subdirs
+SUBDIRS += kernels \
+    render
+
+check.CONFIG = recursive
+QMAKE_EXTRA_TARGETS += check
@@ -5,12 +5,43 @@ TARGET = timecode4
 TEMPLATE = app
 SOURCES += main.cpp \
     mainwindow.cpp \
-    ctimecodeitemgroup.cpp
+    ctimecodeitemgroup.cpp \
+    ctimecodesettings.cpp \
+    cjobcache.cpp \
+    ctimecoderenderer.cpp \
+    ctimecodejob.cpp \
+    cjobqueue.cpp \
+    cwatchfolder.cpp \
+    cpixelkernels.cpp \
+    cstriprenderer.cpp \
+    cglyphcache.cpp \
+    cworkerplacement.cpp \
+    crenderverifier.cpp
 HEADERS += mainwindow.h \
-    ctimecodeitemgroup.h
+    ctimecodeitemgroup.h \
+    ctimecodesettings.h \
+    cjobcache.h \
+    ctimecoderenderer.h \
+    ctimecodejob.h \
+    cjobqueue.h \
+    cwatchfolder.h \
+    cpixelkernels.h \
+    cstriprenderer.h \
+    cglyphcache.h \
+    cworkerplacement.h \
+    crenderverifier.h \
+    ccanceltoken.h
 FORMS += mainwindow.ui
 RESOURCES +=
-OTHER_FILES +=
+OTHER_FILES += libpng.pri
 icons.files = application.icns
 icons.path = Contents/Resources
 QMAKE_BUNDLE_DATA += icons
+
+include( libpng.pri )
+
+# "make check" builds and runs the tests in tests/ next to the application
+# (the render tests paint text, on X11 they need a display: xvfb-run make check)
+check.commands = $(MKDIR) tests && cd tests && $$QMAKE_QMAKE $$PWD/tests/tests.pro && $(MAKE) check
+check.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += check